@@ -0,0 +1,131 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWAccessPattern.h"
+
+// steps of equal size before they count as a pattern
+#define kPatternMinRun 2
+
+BlackmagicRAWAccessPattern::BlackmagicRAWAccessPattern()
+{
+    reset();
+}
+
+void BlackmagicRAWAccessPattern::reset()
+{
+    _last = -1;
+    _lastDelta = 0;
+    _stride = 0;
+    _runLength = 0;
+    _jumpPending = false;
+    _jumpFrom = 0;
+    _jumpTo = 0;
+    _loop = false;
+    _loopIn = 0;
+    _loopOut = 0;
+}
+
+void BlackmagicRAWAccessPattern::record(int64_t frame)
+{
+    if (frame < 0) { return; }
+    if (_last < 0) {
+        _last = frame;
+        return;
+    }
+    int64_t delta = frame - _last;
+    if (delta == 0) { return; }
+    if (_loop && !_jumpPending && _last == _loopOut && frame == _loopIn) {
+        // the wrap of a known loop, the stride goes on
+        _last = frame;
+        return;
+    }
+
+    if (delta == _stride) {
+        ++_runLength;
+        if (_jumpPending) {
+            // same stride after a jump back is a loop, a jump ahead a seek
+            _jumpPending = false;
+            if ((_jumpTo - _jumpFrom) * _stride < 0) {
+                _loop = true;
+                _loopIn = _jumpTo;
+                _loopOut = _jumpFrom;
+            }
+        }
+    } else if (_runLength >= kPatternMinRun && !_jumpPending) {
+        // keep the stride until we know if this was a loop or a seek
+        _jumpPending = true;
+        _jumpFrom = _last;
+        _jumpTo = frame;
+    } else {
+        _stride = delta;
+        _runLength = delta == _lastDelta ? 2 : 1;
+        _jumpPending = false;
+        _loop = false;
+    }
+    _lastDelta = delta;
+    _last = frame;
+}
+
+BlackmagicRAWAccessPattern::Kind BlackmagicRAWAccessPattern::kind() const
+{
+    if (_runLength < kPatternMinRun || _jumpPending) { return patternNone; }
+    return _loop ? patternLoop : patternStride;
+}
+
+int64_t BlackmagicRAWAccessPattern::stride() const
+{
+    return kind() == patternNone ? 0 : _stride;
+}
+
+std::vector<int64_t> BlackmagicRAWAccessPattern::predict(int count,
+                                                         int64_t frameCount,
+                                                         bool guess) const
+{
+    std::vector<int64_t> frames;
+    if (_last < 0) { return frames; }
+    Kind pattern = kind();
+    int64_t step = stride();
+    if (pattern == patternNone) {
+        if (!guess) { return frames; }
+        step = _lastDelta < 0 ? -1 : 1;
+    }
+
+    // only wrap while playing inside the loop range
+    bool wrap = false;
+    if (pattern == patternLoop) {
+        int64_t first = step > 0 ? _loopIn : _loopOut;
+        int64_t last = step > 0 ? _loopOut : _loopIn;
+        wrap = _last >= first && _last <= last;
+    }
+
+    int64_t frame = _last;
+    for (int i = 0; i < count; ++i) {
+        frame += step;
+        if (wrap && (frame - _loopOut) * step > 0) {
+            frame = _loopIn;
+        }
+        if (frame < 0 || frame >= frameCount || frame == _last) { break; }
+        frames.push_back(frame);
+    }
+    return frames;
+}
@@ -0,0 +1,76 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWACCESSPATTERN_H
+#define BLACKMAGICRAWACCESSPATTERN_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Learns how frames are being requested from the sequence of frame numbers.
+ *
+ * A run of equal steps is a stride: 1 is forward playback, -1 reverse and
+ * anything else a render node taking every Nth frame (or a fast scrub). A
+ * jump back against the direction of an established stride, followed by the
+ * same stride again, is a loop over an in/out range, and predictions wrap
+ * around it. Single frame re-renders are ignored.
+ */
+class BlackmagicRAWAccessPattern
+{
+public:
+    enum Kind
+    {
+        patternNone = 0,
+        patternStride,
+        patternLoop
+    };
+
+    BlackmagicRAWAccessPattern();
+
+    void record(int64_t frame);
+    void reset();
+    Kind kind() const;
+    int64_t stride() const;
+    // frames that will most likely be requested after the last recorded one,
+    // nearest first and inside [0, frameCount). Without an established
+    // pattern it's empty, unless guess is set: then it's the direction of
+    // the last step, or forward
+    std::vector<int64_t> predict(int count,
+                                 int64_t frameCount,
+                                 bool guess) const;
+
+private:
+    int64_t _last;
+    int64_t _lastDelta;
+    int64_t _stride;
+    int _runLength; // steps of _stride in a row
+    bool _jumpPending; // a jump interrupted the run, the next step tells if it's a loop
+    int64_t _jumpFrom;
+    int64_t _jumpTo;
+    bool _loop;
+    int64_t _loopIn;
+    int64_t _loopOut;
+};
+
+#endif // BLACKMAGICRAWACCESSPATTERN_H
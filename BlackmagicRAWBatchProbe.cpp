@@ -0,0 +1,121 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWBatchProbe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// probing is mostly waiting on file I/O, but each worker holds a codec
+#define kMaxProbeThreads 16
+
+std::vector<std::string> BlackmagicRAWBatchProbe::listClips(const std::string &dir)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) { names.push_back(data.cFileName); }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+    const char separator = '\\';
+#else
+    DIR *handle = opendir(dir.c_str());
+    if (handle != nullptr) {
+        struct dirent *entry;
+        while ((entry = readdir(handle)) != nullptr) {
+            names.push_back(entry->d_name);
+        }
+        closedir(handle);
+    }
+    const char separator = '/';
+#endif
+
+    std::vector<std::string> files;
+    for (size_t i = 0; i < names.size(); ++i) {
+        const std::string &name = names[i];
+        if (name.size() <= 5 || name[0] == '.') { continue; }
+        std::string extension = name.substr(name.size() - 5);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension != ".braw") { continue; }
+        std::string file = dir;
+        if (!file.empty() && file[file.size() - 1] != separator) { file += separator; }
+        files.push_back(file + name);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::vector<BlackmagicRAWBatchProbe::Result>
+BlackmagicRAWBatchProbe::probe(const std::vector<std::string> &files,
+                               const std::string &path,
+                               int threads)
+{
+    std::vector<Result> results(files.size());
+    if (files.empty()) { return results; }
+    if (threads <= 0) { threads = (int)std::thread::hardware_concurrency(); }
+    threads = std::max(1, std::min(threads, std::min((int)files.size(), kMaxProbeThreads)));
+
+    // hold the factory for the whole batch, workers share it through getClipSpecs
+    IBlackmagicRawFactory *factory = BlackmagicRAWHandler::acquireFactory(path);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(std::thread([&]() {
+#ifdef _WIN32
+            CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+            for (size_t index = next++; index < files.size(); index = next++) {
+                Result &result = results[index];
+                result.filename = files[index];
+                result.specs = BlackmagicRAWHandler::getClipSpecs(files[index], path, &result.error);
+                if (result.specs.width <= 0 || result.specs.height <= 0) {
+                    if (result.error.empty()) { result.error = "Unable to read clip"; }
+                } else {
+                    result.error.clear(); // partial failures still give usable specs
+                }
+            }
+#ifdef _WIN32
+            CoUninitialize();
+#endif
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+
+    if (factory != nullptr) { factory->Release(); }
+    return results;
+}
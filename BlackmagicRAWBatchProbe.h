@@ -0,0 +1,55 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWBATCHPROBE_H
+#define BLACKMAGICRAWBATCHPROBE_H
+
+#include "BlackmagicRAWHandler.h"
+
+/*
+ * Concurrent clip probing for bin and card imports.
+ *
+ * Clips are probed through BlackmagicRAWHandler::getClipSpecs on a bounded
+ * pool of worker threads, all sharing the process-wide factory, so the
+ * in-memory and persistent spec caches are filled along the way.
+ */
+class BlackmagicRAWBatchProbe
+{
+public:
+    struct Result
+    {
+        std::string filename;
+        BlackmagicRAWHandler::BlackmagicRAWSpecs specs;
+        std::string error; // empty on success
+    };
+
+    // .braw files of a directory (not recursive), sorted by name
+    static std::vector<std::string> listClips(const std::string &dir);
+    // probe every file, results are in the same order as files. threads
+    // <= 0 uses one worker per CPU core
+    static std::vector<Result> probe(const std::vector<std::string> &files,
+                                     const std::string &path,
+                                     int threads = 0);
+};
+
+#endif // BLACKMAGICRAWBATCHPROBE_H
@@ -0,0 +1,224 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWBenchmark.h"
+#include "BlackmagicRAWSession.h"
+#include "BlackmagicRAWTransfer.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// frames timed per instruction set, after one warm-up frame
+#define kBenchmarkFrames 3
+
+namespace {
+std::string getCPUName()
+{
+    unsigned int brand[12] = {0};
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0x80000000);
+    if ((unsigned int)info[0] >= 0x80000004) {
+        for (int i = 0; i < 3; ++i) {
+            __cpuid((int*)brand + i * 4, 0x80000002 + i);
+        }
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+        for (unsigned int i = 0; i < 3; ++i) {
+            __get_cpuid(0x80000002 + i, &brand[i * 4], &brand[i * 4 + 1], &brand[i * 4 + 2], &brand[i * 4 + 3]);
+        }
+    }
+#endif
+    std::string name((const char*)brand, strnlen((const char*)brand, sizeof(brand)));
+    size_t first = name.find_first_not_of(' ');
+    return first == std::string::npos ? std::string("unknown") : name.substr(first);
+}
+
+const char* getInstructionSetName(int instructionSet)
+{
+    switch (instructionSet) {
+    case BlackmagicRAWHandler::rawInstructionSetSSE41:
+        return "sse41";
+    case BlackmagicRAWHandler::rawInstructionSetAVX:
+        return "avx";
+    case BlackmagicRAWHandler::rawInstructionSetAVX2:
+        return "avx2";
+    default:;
+    }
+    return "auto";
+}
+
+std::string getResultsFilename()
+{
+    std::string dir = BlackmagicRAWHandler::getCacheDir();
+    if (dir.empty()) { return dir; }
+#ifdef _WIN32
+    return dir + "\\benchmark.txt";
+#else
+    return dir + "/benchmark.txt";
+#endif
+}
+
+// machine key -> instruction set name, one "key=name" per line
+std::map<std::string, std::string> readResults()
+{
+    std::map<std::string, std::string> results;
+    std::string filename = getResultsFilename();
+    if (filename.empty()) { return results; }
+    std::ifstream file(filename.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t separator = line.rfind('=');
+        if (separator == std::string::npos) { continue; }
+        results[line.substr(0, separator)] = line.substr(separator + 1);
+    }
+    return results;
+}
+
+void writeResults(const std::map<std::string, std::string> &results)
+{
+    std::string filename = getResultsFilename();
+    if (filename.empty()) { return; }
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream file(tmp.c_str());
+        for (std::map<std::string, std::string>::const_iterator it = results.begin(); it != results.end(); ++it) {
+            file << it->first << "=" << it->second << std::endl;
+        }
+        if (!file) { return; }
+    }
+#ifdef _WIN32
+    remove(filename.c_str());
+#endif
+    rename(tmp.c_str(), filename.c_str());
+}
+}
+
+std::string BlackmagicRAWBenchmark::getMachineKey(const std::string &path)
+{
+    std::string key = getCPUName() + "|" + path;
+    for (size_t i = 0; i < key.size(); ++i) {
+        if (key[i] == '=' || key[i] == '\n') { key[i] = '_'; }
+    }
+    return key;
+}
+
+double BlackmagicRAWBenchmark::measure(int instructionSet,
+                                       const std::string &filename,
+                                       const std::string &path)
+{
+    BlackmagicRAWHandler::BlackmagicRAWSpecs specs = BlackmagicRAWHandler::getClipSpecs(filename, path);
+    // every frame needs its own decode, a repeated one would come from the
+    // session's decoded frames and only time the processing
+    if (specs.frameMax <= kBenchmarkFrames) {
+        std::cout << "Clip too short to benchmark: " << filename << std::endl;
+        return 0;
+    }
+
+    // its own session with every CPU, distinct frames so nothing is reused
+    BlackmagicRAWSession session;
+    session.setCPUThreads(BlackmagicRAWHandler::getAvailableCPUCount());
+    session.setInstructionSet(instructionSet);
+    if (!session.open(filename, path)) { return 0; }
+    BlackmagicRAWFrameCache::Key key;
+    key.file = BlackmagicRAWHandler::getFileIdentity(filename);
+    key.quality = specs.quality;
+    key.processingHash = BlackmagicRAWHandler::getProcessingHash(specs);
+    double seconds = 0;
+    for (int i = 0; i <= kBenchmarkFrames; ++i) {
+        key.frame = i;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!session.decodeFrame(key, specs)) { return 0; }
+        if (i > 0) {
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+    return seconds;
+}
+
+int BlackmagicRAWBenchmark::getBestInstructionSet(const std::string &filename,
+                                                  const std::string &path)
+{
+    // one benchmark at a time, the result is kept for the process lifetime
+    static std::mutex* benchmarkMutex = new std::mutex();
+    static std::map<std::string, int>* best = new std::map<std::string, int>();
+    std::lock_guard<std::mutex> lock(*benchmarkMutex);
+
+    std::string key = getMachineKey(path);
+    std::map<std::string, int>::const_iterator found = best->find(key);
+    if (found != best->end()) { return found->second; }
+
+    const int candidates[] = {
+        BlackmagicRAWHandler::rawInstructionSetSSE41,
+        BlackmagicRAWHandler::rawInstructionSetAVX,
+        BlackmagicRAWHandler::rawInstructionSetAVX2
+    };
+    std::map<std::string, std::string> results = readResults();
+    std::map<std::string, std::string>::const_iterator stored = results.find(key);
+    if (stored != results.end()) {
+        for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+            if (stored->second == getInstructionSetName(candidates[i])) {
+                (*best)[key] = candidates[i];
+                return candidates[i];
+            }
+        }
+    }
+
+    // only what the CPU supports, SDK jobs would fail otherwise
+    BlackmagicRAWTransfer::InstructionSet supported = BlackmagicRAWTransfer::getInstructionSet();
+    const BlackmagicRAWTransfer::InstructionSet required[] = {
+        BlackmagicRAWTransfer::instructionSetSSE41,
+        BlackmagicRAWTransfer::instructionSetAVX,
+        BlackmagicRAWTransfer::instructionSetAVX2
+    };
+    int result = BlackmagicRAWHandler::rawInstructionSetAuto;
+    double fastest = 0;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        if (supported < required[i]) { continue; }
+        double seconds = measure(candidates[i], filename, path);
+        if (seconds > 0 && (fastest == 0 || seconds < fastest)) {
+            fastest = seconds;
+            result = candidates[i];
+        }
+    }
+
+    // failed runs aren't stored on disk, the clip may just be broken
+    if (result != BlackmagicRAWHandler::rawInstructionSetAuto) {
+        results = readResults();
+        results[key] = getInstructionSetName(result);
+        writeResults(results);
+    }
+    (*best)[key] = result;
+    return result;
+}
@@ -0,0 +1,53 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWBENCHMARK_H
+#define BLACKMAGICRAWBENCHMARK_H
+
+#include "BlackmagicRAWHandler.h"
+
+/*
+ * One-shot instruction set benchmark of the SDK CPU pipeline.
+ *
+ * Times a few frames of a sample clip with every SDK instruction set the CPU
+ * supports and remembers the fastest, per CPU model and SDK library, in the
+ * plugin cache directory. Later calls, in this or any other process, only
+ * look the result up. Clips too short to time distinct frames aren't
+ * measured, and nothing is stored for them.
+ */
+class BlackmagicRAWBenchmark
+{
+public:
+    // fastest BlackmagicRAWHandler::BlackmagicRAWInstructionSet, measured on
+    // filename if not known yet. rawInstructionSetAuto if it can't be measured
+    static int getBestInstructionSet(const std::string &filename,
+                                     const std::string &path);
+
+private:
+    static std::string getMachineKey(const std::string &path);
+    static double measure(int instructionSet,
+                          const std::string &filename,
+                          const std::string &path);
+};
+
+#endif // BLACKMAGICRAWBENCHMARK_H
@@ -0,0 +1,169 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWBufferPool.h"
+
+#include <cstdlib>
+#include <iterator>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define kBufferAlignment 64
+#define kHugePageSize (2 << 20)
+#define kHugePageThreshold (8 << 20)
+#define kRetainLimitDefault ((size_t)1024 << 20)
+
+BlackmagicRAWBufferPool& BlackmagicRAWBufferPool::instance()
+{
+    // never destroyed, frames released at static destruction still return here
+    static BlackmagicRAWBufferPool* pool = new BlackmagicRAWBufferPool();
+    return *pool;
+}
+
+BlackmagicRAWBufferPool::BlackmagicRAWBufferPool()
+: _retainLimit(kRetainLimitDefault)
+{
+}
+
+size_t BlackmagicRAWBufferPool::sizeClass(size_t sizeBytes)
+{
+    // frames of a clip share a size, round large ones to whole huge pages
+    // so nearly equal bit streams share a class too
+    size_t alignment = sizeBytes >= kHugePageThreshold ? kHugePageSize : kBufferAlignment;
+    if (sizeBytes == 0) { sizeBytes = 1; }
+    return (sizeBytes + alignment - 1) & ~(alignment - 1);
+}
+
+void* BlackmagicRAWBufferPool::allocate(size_t sizeBytes)
+{
+    size_t alignment = sizeBytes >= kHugePageThreshold ? kHugePageSize : kBufferAlignment;
+#ifdef _WIN32
+    return _aligned_malloc(sizeBytes, alignment);
+#else
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, alignment, sizeBytes) != 0) { return nullptr; }
+#ifdef MADV_HUGEPAGE
+    if (sizeBytes >= kHugePageThreshold) {
+        madvise(buffer, sizeBytes, MADV_HUGEPAGE); // only a hint, may fail
+    }
+#endif
+    return buffer;
+#endif
+}
+
+void BlackmagicRAWBufferPool::deallocate(void *buffer)
+{
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+std::shared_ptr<char> BlackmagicRAWBufferPool::acquire(size_t sizeBytes)
+{
+    size_t size = sizeClass(sizeBytes);
+    char *buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::multimap<size_t, FreeList::iterator>::iterator it = _free.find(size);
+        if (it != _free.end()) {
+            buffer = (char*)it->second->second;
+            _freeList.erase(it->second);
+            _free.erase(it);
+            _stats.pooledBytes -= size;
+            _stats.hits++;
+        } else {
+            _stats.misses++;
+        }
+        _stats.usedBytes += size;
+    }
+    if (buffer == nullptr) {
+        buffer = (char*)allocate(size);
+        if (buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stats.usedBytes -= size;
+            return std::shared_ptr<char>();
+        }
+    }
+    return std::shared_ptr<char>(buffer, [this, size](char *released) { recycle(released, size); });
+}
+
+void BlackmagicRAWBufferPool::recycle(char *buffer, size_t sizeBytes)
+{
+    std::vector<std::pair<void*, size_t> > released;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.usedBytes -= sizeBytes;
+        _freeList.push_back(std::make_pair(sizeBytes, (void*)buffer));
+        _free.insert(std::make_pair(sizeBytes, std::prev(_freeList.end())));
+        _stats.pooledBytes += sizeBytes;
+        trimLocked(_retainLimit, &released);
+    }
+    for (size_t i = 0; i < released.size(); ++i) {
+        deallocate(released[i].first);
+    }
+}
+
+void BlackmagicRAWBufferPool::trimLocked(size_t limit,
+                                         std::vector<std::pair<void*, size_t> > *released)
+{
+    // buffers of a size still in use come back soon, so the ones that
+    // weren't needed for the longest go first
+    while (_stats.pooledBytes > limit && !_freeList.empty()) {
+        FreeList::iterator oldest = _freeList.begin();
+        std::pair<std::multimap<size_t, FreeList::iterator>::iterator,
+                  std::multimap<size_t, FreeList::iterator>::iterator> range = _free.equal_range(oldest->first);
+        for (std::multimap<size_t, FreeList::iterator>::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == oldest) {
+                _free.erase(it);
+                break;
+            }
+        }
+        released->push_back(std::make_pair(oldest->second, oldest->first));
+        _stats.pooledBytes -= oldest->first;
+        _freeList.erase(oldest);
+    }
+}
+
+void BlackmagicRAWBufferPool::setRetainLimit(size_t bytes)
+{
+    std::vector<std::pair<void*, size_t> > released;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _retainLimit = bytes;
+        trimLocked(_retainLimit, &released);
+    }
+    for (size_t i = 0; i < released.size(); ++i) {
+        deallocate(released[i].first);
+    }
+}
+
+BlackmagicRAWBufferPool::Stats BlackmagicRAWBufferPool::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
@@ -0,0 +1,83 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWBUFFERPOOL_H
+#define BLACKMAGICRAWBUFFERPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Process-wide pool of 64-byte aligned host buffers.
+ *
+ * Frame sized buffers (bit streams, decoded and processed images) are
+ * recycled instead of being returned to the system, so steady-state playback
+ * does no large allocations. Sizes are rounded up to a size class, large
+ * buffers are 2 MB aligned and marked for transparent huge pages. Free
+ * buffers above the retain limit are released, least recently freed first.
+ * The frame cache sets the limit from its budget.
+ */
+class BlackmagicRAWBufferPool
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t pooledBytes = 0; // free buffers kept for reuse
+        size_t usedBytes = 0; // buffers currently handed out
+    };
+
+    static BlackmagicRAWBufferPool& instance();
+
+    // buffer of at least sizeBytes, returned to the pool when released
+    std::shared_ptr<char> acquire(size_t sizeBytes);
+    // free buffers kept above this are released to the system
+    void setRetainLimit(size_t bytes);
+    Stats stats();
+
+private:
+    BlackmagicRAWBufferPool();
+    BlackmagicRAWBufferPool(const BlackmagicRAWBufferPool&) = delete;
+    BlackmagicRAWBufferPool& operator=(const BlackmagicRAWBufferPool&) = delete;
+    static size_t sizeClass(size_t sizeBytes);
+    static void* allocate(size_t sizeBytes);
+    static void deallocate(void *buffer);
+    void recycle(char *buffer, size_t sizeBytes);
+    void trimLocked(size_t limit, std::vector<std::pair<void*, size_t> > *released);
+
+    typedef std::list<std::pair<size_t, void*> > FreeList;
+
+    std::mutex _mutex;
+    FreeList _freeList; // size class and buffer, least recently freed first
+    std::multimap<size_t, FreeList::iterator> _free; // size class -> free buffers
+    size_t _retainLimit;
+    Stats _stats;
+};
+
+#endif // BLACKMAGICRAWBUFFERPOOL_H
@@ -0,0 +1,420 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWClipIndex.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// file magic and layout version, bump on any change to the record layout
+#define kClipIndexMagic "BRAWIDX1"
+#define kClipIndexVersion 2
+#define kClipIndexHeaderBytes 4096
+
+namespace {
+// bounds checked reader over a record
+class Reader
+{
+public:
+    Reader(const char *data, size_t size) : _data(data), _size(size), _offset(0), _ok(true) {}
+    bool ok() const { return _ok; }
+    template<typename T>
+    T read()
+    {
+        T value = T();
+        if (_offset + sizeof(T) > _size) { _ok = false; return value; }
+        std::memcpy(&value, _data + _offset, sizeof(T));
+        _offset += sizeof(T);
+        return value;
+    }
+    std::string readString()
+    {
+        uint32_t length = read<uint32_t>();
+        if (!_ok || _offset + length > _size) { _ok = false; return std::string(); }
+        std::string value(_data + _offset, length);
+        _offset += length;
+        return value;
+    }
+    std::vector<std::string> readStrings()
+    {
+        std::vector<std::string> values;
+        uint32_t count = read<uint32_t>();
+        for (uint32_t i = 0; i < count && _ok; ++i) {
+            values.push_back(readString());
+        }
+        return values;
+    }
+private:
+    const char *_data;
+    size_t _size;
+    size_t _offset;
+    bool _ok;
+};
+
+template<typename T>
+void write(std::string *data, const T &value)
+{
+    data->append((const char*)&value, sizeof(T));
+}
+void writeString(std::string *data, const std::string &value)
+{
+    write(data, (uint32_t)value.size());
+    data->append(value);
+}
+void writeStrings(std::string *data, const std::vector<std::string> &values)
+{
+    write(data, (uint32_t)values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        writeString(data, values[i]);
+    }
+}
+
+// exclusive advisory lock between processes sharing the index, held until destroyed.
+// a sibling file since compaction renames a new file over the index
+class FileLock
+{
+public:
+    explicit FileLock(const std::string &filename)
+    {
+#ifdef _WIN32
+        _handle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE) { return; }
+        OVERLAPPED overlapped = {};
+        if (!LockFileEx(_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped)) {
+            CloseHandle(_handle);
+            _handle = INVALID_HANDLE_VALUE;
+        }
+#else
+        _fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd < 0) { return; }
+        int result;
+        do {
+            result = flock(_fd, LOCK_EX);
+        } while (result != 0 && errno == EINTR);
+        if (result != 0) {
+            close(_fd);
+            _fd = -1;
+        }
+#endif
+    }
+    ~FileLock()
+    {
+#ifdef _WIN32
+        if (_handle == INVALID_HANDLE_VALUE) { return; }
+        OVERLAPPED overlapped = {};
+        UnlockFileEx(_handle, 0, 1, 0, &overlapped);
+        CloseHandle(_handle);
+#else
+        if (_fd < 0) { return; }
+        flock(_fd, LOCK_UN);
+        close(_fd);
+#endif
+    }
+    bool locked() const
+    {
+#ifdef _WIN32
+        return _handle != INVALID_HANDLE_VALUE;
+#else
+        return _fd >= 0;
+#endif
+    }
+private:
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+#ifdef _WIN32
+    HANDLE _handle;
+#else
+    int _fd;
+#endif
+};
+
+std::string getCanonicalPath(const std::string &filename)
+{
+#ifdef _WIN32
+    char buffer[_MAX_PATH];
+    if (_fullpath(buffer, filename.c_str(), _MAX_PATH) != nullptr) { return buffer; }
+#else
+    char *path = realpath(filename.c_str(), nullptr);
+    if (path != nullptr) {
+        std::string result(path);
+        free(path);
+        return result;
+    }
+#endif
+    return filename;
+}
+
+std::string getHeader()
+{
+    std::string header(kClipIndexMagic);
+    write(&header, (uint32_t)kClipIndexVersion);
+    return header;
+}
+}
+
+BlackmagicRAWClipIndex& BlackmagicRAWClipIndex::instance()
+{
+    static BlackmagicRAWClipIndex* index = new BlackmagicRAWClipIndex();
+    return *index;
+}
+
+bool BlackmagicRAWClipIndex::getKey(const std::string &filename,
+                                    Key *key)
+{
+    BlackmagicRAWHandler::FileIdentity identity = BlackmagicRAWHandler::getFileIdentity(filename);
+    if (identity.size < 0) { return false; }
+    key->path = getCanonicalPath(filename);
+    key->size = identity.size;
+    key->mtime = identity.mtime;
+    key->sidecarSize = identity.sidecarSize;
+    key->sidecarMtime = identity.sidecarMtime;
+
+    // FNV-1a of the start of the clip, catches files replaced with the same size and mtime
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == nullptr) { return false; }
+    char header[kClipIndexHeaderBytes];
+    size_t size = fread(header, 1, sizeof(header), file);
+    fclose(file);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)header[i];
+        hash *= 1099511628211ULL;
+    }
+    key->headerHash = hash;
+    return true;
+}
+
+void BlackmagicRAWClipIndex::serialize(const Entry &entry,
+                                       std::string *data)
+{
+    const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs = entry.specs;
+    std::string record;
+    writeString(&record, entry.key.path);
+    write(&record, entry.key.size);
+    write(&record, entry.key.mtime);
+    write(&record, entry.key.headerHash);
+    write(&record, entry.key.sidecarSize);
+    write(&record, entry.key.sidecarMtime);
+    write(&record, (int32_t)specs.width);
+    write(&record, (int32_t)specs.height);
+    write(&record, specs.fps);
+    write(&record, (int32_t)specs.frameMax);
+    writeString(&record, specs.gamut);
+    writeString(&record, specs.gamma);
+    write(&record, (int32_t)specs.iso);
+    write(&record, (int32_t)specs.colorTemp);
+    write(&record, (int32_t)specs.tint);
+    write(&record, specs.exposure);
+    write(&record, specs.saturation);
+    write(&record, specs.contrast);
+    write(&record, specs.midpoint);
+    write(&record, specs.highlights);
+    write(&record, specs.shadows);
+    write(&record, specs.whiteLevel);
+    write(&record, specs.blackLevel);
+    write(&record, (uint8_t)specs.videoBlackLevel);
+    writeStrings(&record, specs.availableISO);
+    writeStrings(&record, specs.availableGamma);
+    writeStrings(&record, specs.availableGamut);
+
+    // size prefixed so readers can skip records they fail to parse
+    write(data, (uint32_t)record.size());
+    data->append(record);
+}
+
+bool BlackmagicRAWClipIndex::deserialize(const char *data,
+                                         size_t size,
+                                         Entry *entry)
+{
+    BlackmagicRAWHandler::BlackmagicRAWSpecs &specs = entry->specs;
+    Reader reader(data, size);
+    entry->key.path = reader.readString();
+    entry->key.size = reader.read<long long>();
+    entry->key.mtime = reader.read<long long>();
+    entry->key.headerHash = reader.read<uint64_t>();
+    entry->key.sidecarSize = reader.read<long long>();
+    entry->key.sidecarMtime = reader.read<long long>();
+    specs.width = reader.read<int32_t>();
+    specs.height = reader.read<int32_t>();
+    specs.fps = reader.read<double>();
+    specs.frameMax = reader.read<int32_t>();
+    specs.gamut = reader.readString();
+    specs.gamma = reader.readString();
+    specs.iso = reader.read<int32_t>();
+    specs.colorTemp = reader.read<int32_t>();
+    specs.tint = reader.read<int32_t>();
+    specs.exposure = reader.read<double>();
+    specs.saturation = reader.read<double>();
+    specs.contrast = reader.read<double>();
+    specs.midpoint = reader.read<double>();
+    specs.highlights = reader.read<double>();
+    specs.shadows = reader.read<double>();
+    specs.whiteLevel = reader.read<double>();
+    specs.blackLevel = reader.read<double>();
+    specs.videoBlackLevel = reader.read<uint8_t>() != 0;
+    specs.availableISO = reader.readStrings();
+    specs.availableGamma = reader.readStrings();
+    specs.availableGamut = reader.readStrings();
+    return reader.ok();
+}
+
+void BlackmagicRAWClipIndex::loadLocked()
+{
+    if (_loaded) { return; }
+    _loaded = true;
+    std::string dir = BlackmagicRAWHandler::getCacheDir();
+    if (dir.empty()) { return; }
+#ifdef _WIN32
+    _filename = dir + "\\clips.idx";
+    FileLock fileLock(_filename + ".lock");
+    std::ifstream stream(_filename.c_str(), std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    const char *data = content.data();
+    size_t size = content.size();
+#else
+    _filename = dir + "/clips.idx";
+    FileLock fileLock(_filename + ".lock");
+    const char *data = nullptr;
+    size_t size = 0;
+    int fd = open(_filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = (const char*)mapped;
+                size = (size_t)info.st_size;
+            }
+        }
+        close(fd);
+    }
+#endif
+
+    // records after the header, later ones replace earlier ones
+    std::string header = getHeader();
+    bool valid = size >= header.size() && std::memcmp(data, header.data(), header.size()) == 0;
+    size_t offset = header.size();
+    while (valid && offset + sizeof(uint32_t) <= size) {
+        uint32_t recordSize = 0;
+        std::memcpy(&recordSize, data + offset, sizeof(recordSize));
+        offset += sizeof(recordSize);
+        if (offset + recordSize > size) { break; } // truncated by a crashed writer
+        Entry entry;
+        if (deserialize(data + offset, recordSize, &entry)) {
+            _entries[entry.key.path] = entry;
+        }
+        offset += recordSize;
+        _records++;
+    }
+
+#ifndef _WIN32
+    if (data != nullptr) { munmap((void*)data, size); }
+#endif
+
+    // start over on a foreign or outdated file, rewrite when mostly stale.
+    // only under the file lock, a rewrite would drop records appended meanwhile
+    if (fileLock.locked() && (!valid || _records > 2 * _entries.size() + 64)) {
+        compactLocked();
+    }
+}
+
+void BlackmagicRAWClipIndex::compactLocked()
+{
+    if (_filename.empty()) { return; }
+    std::string data = getHeader();
+    for (std::map<std::string, Entry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        serialize(it->second, &data);
+    }
+    std::string tmp = _filename + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file == nullptr) { return; }
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    if (written) { remove(_filename.c_str()); }
+#endif
+    if (!written || rename(tmp.c_str(), _filename.c_str()) != 0) {
+        remove(tmp.c_str());
+        return;
+    }
+    _records = _entries.size();
+}
+
+bool BlackmagicRAWClipIndex::find(const std::string &filename,
+                                  BlackmagicRAWHandler::BlackmagicRAWSpecs *specs)
+{
+    Key key;
+    if (specs == nullptr || !getKey(filename, &key)) { return false; }
+    std::lock_guard<std::mutex> lock(_mutex);
+    loadLocked();
+    std::map<std::string, Entry>::const_iterator it = _entries.find(key.path);
+    if (it == _entries.end() || !(it->second.key == key)) { return false; }
+    *specs = it->second.specs;
+    return true;
+}
+
+void BlackmagicRAWClipIndex::store(const std::string &filename,
+                                   const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs)
+{
+    Entry entry;
+    if (!getKey(filename, &entry.key)) { return; }
+    entry.specs = specs;
+    entry.specs.quality = BlackmagicRAWHandler::rawFullQuality;
+    entry.specs.recovery = false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    loadLocked();
+    if (_filename.empty()) { return; }
+    _entries[entry.key.path] = entry;
+
+    // append a single record, other processes may be appending or compacting too
+    FileLock fileLock(_filename + ".lock");
+    std::string data;
+    struct stat info;
+    if (stat(_filename.c_str(), &info) != 0 || info.st_size == 0) {
+        data = getHeader();
+    }
+    serialize(entry, &data);
+    FILE *file = fopen(_filename.c_str(), "ab");
+    if (file == nullptr) { return; }
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+    _records++;
+}
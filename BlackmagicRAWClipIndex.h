@@ -0,0 +1,98 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWCLIPINDEX_H
+#define BLACKMAGICRAWCLIPINDEX_H
+
+#include "BlackmagicRAWHandler.h"
+
+#include <map>
+#include <mutex>
+
+/*
+ * Persistent clip specs index shared by all sessions of the user.
+ *
+ * The index is a single append-only file in the plugin cache directory,
+ * memory mapped and parsed once per process. Entries are keyed on the
+ * canonical path and validated against the file size, modification time
+ * and a hash of the first bytes of the clip, and against the size and
+ * modification time of its sidecar, so a project can be opened
+ * without going through the SDK for clips that were seen before.
+ * Loading, appending and compaction hold an advisory lock on a sibling
+ * file, so processes sharing the index do not lose each other's records.
+ */
+class BlackmagicRAWClipIndex
+{
+public:
+    static BlackmagicRAWClipIndex& instance();
+
+    // specs of a known and unchanged clip
+    bool find(const std::string &filename,
+              BlackmagicRAWHandler::BlackmagicRAWSpecs *specs);
+    // add or replace the specs of a clip
+    void store(const std::string &filename,
+               const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs);
+
+private:
+    struct Key
+    {
+        std::string path;
+        long long size = -1;
+        long long mtime = -1;
+        uint64_t headerHash = 0;
+        long long sidecarSize = -1;
+        long long sidecarMtime = -1;
+        bool operator==(const Key &other) const
+        {
+            return path == other.path && size == other.size &&
+                   mtime == other.mtime && headerHash == other.headerHash &&
+                   sidecarSize == other.sidecarSize && sidecarMtime == other.sidecarMtime;
+        }
+    };
+    struct Entry
+    {
+        Key key;
+        BlackmagicRAWHandler::BlackmagicRAWSpecs specs;
+    };
+
+    BlackmagicRAWClipIndex() = default;
+    BlackmagicRAWClipIndex(const BlackmagicRAWClipIndex&) = delete;
+    BlackmagicRAWClipIndex& operator=(const BlackmagicRAWClipIndex&) = delete;
+    static bool getKey(const std::string &filename,
+                       Key *key);
+    static void serialize(const Entry &entry,
+                          std::string *data);
+    static bool deserialize(const char *data,
+                            size_t size,
+                            Entry *entry);
+    void loadLocked();
+    void compactLocked();
+
+    std::mutex _mutex;
+    bool _loaded = false;
+    std::string _filename;
+    size_t _records = 0; // records in the file, including replaced ones
+    std::map<std::string, Entry> _entries; // by canonical path
+};
+
+#endif // BLACKMAGICRAWCLIPINDEX_H
@@ -0,0 +1,275 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWCompressedFrame.h"
+#include "BlackmagicRAWTransfer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// rows coded together, the unit of work of a thread
+#define kCompressionStripRows 16
+// LZ matches are at least this long and at most this far back
+#define kMinMatch 4
+#define kMaxOffset 65535
+#define kHashBits 14
+// bytes at the end that are always literals, so matching never reads past the input
+#define kLastLiterals 5
+
+namespace {
+uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+void writeLength(std::vector<uint8_t> *out,
+                 size_t length)
+{
+    while (length >= 255) {
+        out->push_back(255);
+        length -= 255;
+    }
+    out->push_back((uint8_t)length);
+}
+
+// LZ77 with LZ4-like sequences: a token (literal count, match length), the
+// literals, a 16-bit offset and the remaining length bytes. The last
+// sequence has literals only. Input without repetition is skipped over
+// faster the longer no match is found.
+void lzCompress(const uint8_t *src,
+                size_t size,
+                std::vector<uint8_t> *out)
+{
+    out->clear();
+    out->reserve(size + size / 255 + 16);
+    std::vector<uint32_t> table((size_t)1 << kHashBits, 0); // position + 1
+    size_t anchor = 0;
+    size_t i = 0;
+    while (size >= kLastLiterals + kMinMatch && i + kMinMatch <= size - kLastLiterals) {
+        uint32_t sequence = read32(src + i);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - kHashBits);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(i + 1);
+        if (candidate == 0 || i - (candidate - 1) > kMaxOffset || read32(src + candidate - 1) != sequence) {
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        --candidate;
+        size_t length = kMinMatch;
+        while (i + length < size - kLastLiterals && src[candidate + length] == src[i + length]) {
+            ++length;
+        }
+
+        size_t literals = i - anchor;
+        size_t matchLength = length - kMinMatch;
+        out->push_back((uint8_t)((std::min(literals, (size_t)15) << 4) | std::min(matchLength, (size_t)15)));
+        if (literals >= 15) { writeLength(out, literals - 15); }
+        out->insert(out->end(), src + anchor, src + i);
+        size_t offset = i - candidate;
+        out->push_back((uint8_t)(offset & 0xff));
+        out->push_back((uint8_t)(offset >> 8));
+        if (matchLength >= 15) { writeLength(out, matchLength - 15); }
+        i += length;
+        anchor = i;
+    }
+    size_t literals = size - anchor;
+    out->push_back((uint8_t)(std::min(literals, (size_t)15) << 4));
+    if (literals >= 15) { writeLength(out, literals - 15); }
+    out->insert(out->end(), src + anchor, src + size);
+}
+
+bool readLength(const uint8_t **in,
+                const uint8_t *end,
+                size_t *length)
+{
+    for (;;) {
+        if (*in >= end) { return false; }
+        uint8_t byte = *(*in)++;
+        *length += byte;
+        if (byte != 255) { return true; }
+    }
+}
+
+// false if the data is corrupt or doesn't decode to exactly size bytes
+bool lzDecompress(const uint8_t *src,
+                  size_t srcSize,
+                  uint8_t *dst,
+                  size_t size)
+{
+    const uint8_t *in = src;
+    const uint8_t *inEnd = src + srcSize;
+    size_t out = 0;
+    for (;;) {
+        if (in >= inEnd) { return false; }
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(&in, inEnd, &literals)) { return false; }
+        if (literals > (size_t)(inEnd - in) || literals > size - out) { return false; }
+        std::memcpy(dst + out, in, literals);
+        in += literals;
+        out += literals;
+        if (out == size) { return in == inEnd; }
+
+        if (inEnd - in < 2) { return false; }
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(&in, inEnd, &length)) { return false; }
+        length += kMinMatch;
+        if (offset == 0 || offset > out || length > size - out) { return false; }
+        if (offset >= length) {
+            std::memcpy(dst + out, dst + out - offset, length);
+        } else {
+            // overlapping, repeats the last offset bytes
+            for (size_t j = 0; j < length; ++j) {
+                dst[out + j] = dst[out + j - offset];
+            }
+        }
+        out += length;
+    }
+}
+
+// samples to byte planes of differences to the previous pixel
+template <typename T>
+void encodeSamples(const T *samples,
+                   size_t count,
+                   uint8_t *planes)
+{
+    for (size_t i = 0; i < count; ++i) {
+        T delta = (T)(samples[i] - (i >= 3 ? samples[i - 3] : 0));
+        for (size_t byte = 0; byte < sizeof(T); ++byte) {
+            planes[byte * count + i] = (uint8_t)(delta >> (byte * 8));
+        }
+    }
+}
+
+template <typename T>
+void decodeSamples(const uint8_t *planes,
+                   size_t count,
+                   T *samples)
+{
+    for (size_t i = 0; i < count; ++i) {
+        T delta = 0;
+        for (size_t byte = 0; byte < sizeof(T); ++byte) {
+            delta = (T)(delta | ((T)planes[byte * count + i] << (byte * 8)));
+        }
+        samples[i] = (T)(delta + (i >= 3 ? samples[i - 3] : 0));
+    }
+}
+}
+
+BlackmagicRAWCompressedFramePtr BlackmagicRAWCompressedFrame::compress(const BlackmagicRAWFrame &frame)
+{
+    std::shared_ptr<BlackmagicRAWCompressedFrame> compressed(new BlackmagicRAWCompressedFrame());
+    compressed->_width = frame.width();
+    compressed->_height = frame.height();
+    compressed->_format = frame.format();
+
+    bool half = frame.format() == BlackmagicRAWFrame::formatRGBF16;
+    size_t rowCount = (size_t)frame.width() * 3;
+    size_t rowBytes = rowCount * (half ? sizeof(uint16_t) : sizeof(float));
+    int stripCount = (frame.height() + kCompressionStripRows - 1) / kCompressionStripRows;
+    std::vector<std::vector<uint8_t> > strips(stripCount);
+    compressed->_strips.resize(stripCount);
+
+    BlackmagicRAWTransfer::forEachStrip(stripCount, [&](int begin, int end) {
+        std::vector<uint8_t> planes;
+        for (int strip = begin; strip < end; ++strip) {
+            int y = strip * kCompressionStripRows;
+            int rows = std::min(kCompressionStripRows, frame.height() - y);
+            size_t count = rowCount * rows;
+            planes.resize(rowBytes * rows);
+            if (half) {
+                encodeSamples(frame.halfData() + rowCount * y, count, planes.data());
+            } else {
+                encodeSamples((const uint32_t*)frame.data() + rowCount * y, count, planes.data());
+            }
+            lzCompress(planes.data(), planes.size(), &strips[strip]);
+            if (strips[strip].size() >= planes.size()) {
+                // incompressible, keep the original samples
+                const char *samples = (const char*)frame.data() + rowBytes * y;
+                strips[strip].assign(samples, samples + planes.size());
+                compressed->_strips[strip].stored = true;
+            }
+        }
+    }, 1);
+
+    size_t total = 0;
+    for (int strip = 0; strip < stripCount; ++strip) {
+        compressed->_strips[strip].offset = total;
+        compressed->_strips[strip].sizeBytes = (uint32_t)strips[strip].size();
+        total += strips[strip].size();
+    }
+    compressed->_data.resize(total);
+    for (int strip = 0; strip < stripCount; ++strip) {
+        if (!strips[strip].empty()) {
+            std::memcpy(&compressed->_data[compressed->_strips[strip].offset], strips[strip].data(), strips[strip].size());
+        }
+    }
+    return compressed;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWCompressedFrame::decompress() const
+{
+    std::shared_ptr<BlackmagicRAWFrame> frame = std::make_shared<BlackmagicRAWFrame>(_width, _height, _format);
+    bool half = _format == BlackmagicRAWFrame::formatRGBF16;
+    size_t rowCount = (size_t)_width * 3;
+    size_t rowBytes = rowCount * (half ? sizeof(uint16_t) : sizeof(float));
+    int stripCount = (int)_strips.size();
+    std::vector<char> failed(stripCount, 0);
+
+    BlackmagicRAWTransfer::forEachStrip(stripCount, [&](int begin, int end) {
+        std::vector<uint8_t> planes;
+        for (int strip = begin; strip < end; ++strip) {
+            int y = strip * kCompressionStripRows;
+            int rows = std::min(kCompressionStripRows, _height - y);
+            size_t count = rowCount * rows;
+            size_t sizeBytes = rowBytes * rows;
+            const uint8_t *data = (const uint8_t*)_data.data() + _strips[strip].offset;
+            char *samples = (char*)frame->data() + rowBytes * y;
+            if (_strips[strip].stored) {
+                if (_strips[strip].sizeBytes != sizeBytes) {
+                    failed[strip] = 1;
+                    continue;
+                }
+                std::memcpy(samples, data, sizeBytes);
+                continue;
+            }
+            planes.resize(sizeBytes);
+            if (!lzDecompress(data, _strips[strip].sizeBytes, planes.data(), sizeBytes)) {
+                failed[strip] = 1;
+                continue;
+            }
+            if (half) {
+                decodeSamples(planes.data(), count, (uint16_t*)samples);
+            } else {
+                decodeSamples(planes.data(), count, (uint32_t*)samples);
+            }
+        }
+    }, 1);
+
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end()) { return BlackmagicRAWFramePtr(); }
+    return frame;
+}
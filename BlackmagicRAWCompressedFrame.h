@@ -0,0 +1,73 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWCOMPRESSEDFRAME_H
+#define BLACKMAGICRAWCOMPRESSEDFRAME_H
+
+#include "BlackmagicRAWFrameCache.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Losslessly compressed copy of a cached frame, for the compressed tier of
+ * the frame cache.
+ *
+ * The frame is cut into strips of rows that are coded independently so both
+ * directions run on several threads. Each sample is stored as the integer
+ * difference to the same channel of the previous pixel, the bytes of those
+ * differences are shuffled into planes (sign/exponent bytes together, low
+ * mantissa bytes together) and the planes are LZ compressed. Strips that
+ * don't get smaller are stored as they are.
+ */
+class BlackmagicRAWCompressedFrame;
+typedef std::shared_ptr<const BlackmagicRAWCompressedFrame> BlackmagicRAWCompressedFramePtr;
+
+class BlackmagicRAWCompressedFrame
+{
+public:
+    // throws std::bad_alloc
+    static BlackmagicRAWCompressedFramePtr compress(const BlackmagicRAWFrame &frame);
+    // frame in its original format, empty if the data is corrupt. Throws std::bad_alloc
+    BlackmagicRAWFramePtr decompress() const;
+    size_t sizeBytes() const { return _data.size() + _strips.size() * sizeof(Strip); }
+
+private:
+    struct Strip
+    {
+        size_t offset = 0;
+        uint32_t sizeBytes = 0;
+        bool stored = false; // not compressed
+    };
+
+    BlackmagicRAWCompressedFrame() = default;
+
+    int _width = 0;
+    int _height = 0;
+    BlackmagicRAWFrame::Format _format = BlackmagicRAWFrame::formatRGBF32;
+    std::vector<Strip> _strips;
+    std::vector<char> _data;
+};
+
+#endif // BLACKMAGICRAWCOMPRESSEDFRAME_H
@@ -0,0 +1,526 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWDiskCache.h"
+#include "BlackmagicRAWTransfer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+// file magic and layout version, bump on any change to the header layout
+#define kDiskCacheMagic "BRAWFRM1"
+#define kDiskCacheVersion 2
+// pixels start at this offset, a page on every supported platform
+#define kDiskCacheHeaderBytes 4096
+#define kDiskCacheSuffix ".frame"
+#define kDiskCacheTmpSuffix ".tmp"
+#define kDiskCacheDefaultBudget ((size_t)32 << 30)
+// frames waiting to be written take up to this share of the frame cache
+// budget, or a single frame, more are dropped
+#define kDiskWriteQueueShare 4
+// half float frames are converted for writing this many values at a time
+#define kDiskWriteChunk (256 * 1024)
+// collect a bit below the budget so it doesn't run on every write
+#define kDiskCacheCollectRatio 0.9
+// temporary files of a crashed writer are removed after a day
+#define kDiskCacheStaleSeconds (24 * 60 * 60)
+
+namespace {
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t filenameBytes; // the clip filename follows the header
+    int32_t width;
+    int32_t height;
+    uint64_t frame;
+    int32_t quality;
+    int32_t reserved;
+    uint64_t processingHash;
+    int64_t fileSize;
+    int64_t fileMtime;
+    int64_t sidecarSize;
+    int64_t sidecarMtime;
+};
+
+// FNV-1a
+inline void hashBytes(uint64_t &hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+std::string joinPath(const std::string &directory,
+                     const std::string &name)
+{
+#ifdef _WIN32
+    return directory + "\\" + name;
+#else
+    return directory + "/" + name;
+#endif
+}
+
+bool endsWith(const std::string &value,
+              const std::string &suffix)
+{
+    return value.size() >= suffix.size() &&
+           value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// size of the file of a frame, always stored as RGBF32
+size_t getFileBytes(const BlackmagicRAWFrame &frame)
+{
+    return kDiskCacheHeaderBytes + (size_t)frame.width() * frame.height() * 3 * sizeof(float);
+}
+
+// pixels of a frame as RGBF32, false if they couldn't all be written
+bool writePixels(FILE *file,
+                 const BlackmagicRAWFrame &frame)
+{
+    size_t count = (size_t)frame.width() * frame.height() * 3;
+    if (frame.format() == BlackmagicRAWFrame::formatRGBF32) {
+        return fwrite(frame.data(), sizeof(float), count, file) == count;
+    }
+    std::vector<float> chunk(std::min(count, (size_t)kDiskWriteChunk));
+    for (size_t i = 0; i < count; i += chunk.size()) {
+        size_t chunkCount = std::min(chunk.size(), count - i);
+        BlackmagicRAWTransfer::unpackHalf(frame.halfData() + i, &chunk[0], chunkCount);
+        if (fwrite(&chunk[0], sizeof(float), chunkCount, file) != chunkCount) { return false; }
+    }
+    return true;
+}
+
+// header page of a frame, empty if the key doesn't fit in it
+std::string getHeader(const BlackmagicRAWFrameCache::Key &key,
+                      const BlackmagicRAWFrame &frame)
+{
+    if (sizeof(Header) + key.file.filename.size() > kDiskCacheHeaderBytes) { return std::string(); }
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kDiskCacheMagic, sizeof(header.magic));
+    header.version = kDiskCacheVersion;
+    header.filenameBytes = (uint32_t)key.file.filename.size();
+    header.width = frame.width();
+    header.height = frame.height();
+    header.frame = key.frame;
+    header.quality = key.quality;
+    header.processingHash = key.processingHash;
+    header.fileSize = key.file.size;
+    header.fileMtime = key.file.mtime;
+    header.sidecarSize = key.file.sidecarSize;
+    header.sidecarMtime = key.file.sidecarMtime;
+    std::string data((const char*)&header, sizeof(header));
+    data.append(key.file.filename);
+    data.resize(kDiskCacheHeaderBytes, '\0');
+    return data;
+}
+
+// frame size from a header page, false if it isn't the one of key
+bool checkHeader(const char *data,
+                 const BlackmagicRAWFrameCache::Key &key,
+                 int *width,
+                 int *height)
+{
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kDiskCacheMagic, sizeof(header.magic)) != 0 ||
+        header.version != kDiskCacheVersion ||
+        header.filenameBytes != key.file.filename.size() ||
+        sizeof(header) + header.filenameBytes > kDiskCacheHeaderBytes ||
+        header.width <= 0 || header.height <= 0) {
+        return false;
+    }
+    // the name is a hash, collisions are caught here
+    if (header.frame != key.frame || header.quality != key.quality ||
+        header.processingHash != key.processingHash ||
+        header.fileSize != key.file.size || header.fileMtime != key.file.mtime ||
+        header.sidecarSize != key.file.sidecarSize || header.sidecarMtime != key.file.sidecarMtime ||
+        std::memcmp(data + sizeof(header), key.file.filename.data(), header.filenameBytes) != 0) {
+        return false;
+    }
+    *width = header.width;
+    *height = header.height;
+    return true;
+}
+}
+
+BlackmagicRAWDiskCache& BlackmagicRAWDiskCache::instance()
+{
+    // never destroyed, its writer thread runs for the lifetime of the process
+    static BlackmagicRAWDiskCache* cache = new BlackmagicRAWDiskCache();
+    return *cache;
+}
+
+BlackmagicRAWDiskCache::BlackmagicRAWDiskCache()
+: _budget(kDiskCacheDefaultBudget)
+, _size(0)
+, _sequence(0)
+, _loaded(false)
+, _queueSize(0)
+, _writerStarted(false)
+{
+}
+
+std::string BlackmagicRAWDiskCache::getName(const BlackmagicRAWFrameCache::Key &key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hashBytes(hash, key.file.filename.data(), key.file.filename.size());
+    hashBytes(hash, &key.file.size, sizeof(key.file.size));
+    hashBytes(hash, &key.file.mtime, sizeof(key.file.mtime));
+    hashBytes(hash, &key.file.sidecarSize, sizeof(key.file.sidecarSize));
+    hashBytes(hash, &key.file.sidecarMtime, sizeof(key.file.sidecarMtime));
+    hashBytes(hash, &key.frame, sizeof(key.frame));
+    hashBytes(hash, &key.quality, sizeof(key.quality));
+    hashBytes(hash, &key.processingHash, sizeof(key.processingHash));
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    return std::string(name) + kDiskCacheSuffix;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWDiskCache::read(const BlackmagicRAWFrameCache::Key &key)
+{
+    std::string name = getName(key);
+    std::string filename;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        loadLocked();
+        if (_directory.empty()) { return BlackmagicRAWFramePtr(); }
+        filename = joinPath(_directory, name);
+    }
+
+    // files are only ever replaced as a whole, never changed in place, so
+    // a mapping stays valid for as long as the frame lives
+    BlackmagicRAWFramePtr frame;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+#ifdef _WIN32
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file != nullptr) {
+        std::string header(kDiskCacheHeaderBytes, '\0');
+        if (fread(&header[0], 1, header.size(), file) == header.size() &&
+            checkHeader(header.data(), key, &width, &height)) {
+            try {
+                std::shared_ptr<BlackmagicRAWFrame> stored = std::make_shared<BlackmagicRAWFrame>(width, height);
+                if (fread(stored->data(), 1, stored->sizeBytes(), file) == stored->sizeBytes()) {
+                    frame = stored;
+                    size = kDiskCacheHeaderBytes + stored->sizeBytes();
+                }
+            } catch (const std::bad_alloc&) {
+            }
+        }
+        fclose(file);
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        char header[kDiskCacheHeaderBytes];
+        if (fstat(fd, &info) == 0 &&
+            pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+            checkHeader(header, key, &width, &height) &&
+            (size_t)info.st_size == kDiskCacheHeaderBytes + (size_t)width * height * 3 * sizeof(float)) {
+            size = (size_t)info.st_size;
+            int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            // read it all in one go instead of a page fault at a time
+            flags |= MAP_POPULATE;
+#endif
+            void *mapped = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+            if (mapped != MAP_FAILED) {
+                std::shared_ptr<char> storage((char*)mapped + kDiskCacheHeaderBytes,
+                                              [mapped, size](char*) { munmap(mapped, size); });
+                frame = std::make_shared<BlackmagicRAWFrame>(width, height, storage);
+            }
+        }
+        close(fd);
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!frame) {
+        // gone, or removed by another process sharing the directory
+        removeLocked(name);
+        return frame;
+    }
+    if (filename == joinPath(_directory, name)) {
+        Entry entry;
+        entry.sizeBytes = size;
+        entry.lastUse = (long long)time(nullptr);
+        addLocked(name, entry);
+        // the modification time keeps the recency for later sessions
+#ifdef _WIN32
+        _utime(filename.c_str(), nullptr);
+#else
+        utime(filename.c_str(), nullptr);
+#endif
+    }
+    return frame;
+}
+
+void BlackmagicRAWDiskCache::write(const BlackmagicRAWFrameCache::Key &key,
+                                   const BlackmagicRAWFramePtr &frame)
+{
+    if (!frame) { return; }
+    size_t queueBudget = BlackmagicRAWFrameCache::instance().budget() / kDiskWriteQueueShare;
+    std::lock_guard<std::mutex> lock(_mutex);
+    loadLocked();
+    if (_directory.empty() || (_queueSize > 0 && _queueSize + frame->sizeBytes() > queueBudget) ||
+        getFileBytes(*frame) > _budget ||
+        _entries.count(getName(key))) {
+        return;
+    }
+    for (size_t i = 0; i < _queue.size(); ++i) {
+        if (_queue[i].first == key) { return; }
+    }
+    _queue.push_back(Job(key, frame));
+    _queueSize += frame->sizeBytes();
+    if (!_writerStarted) {
+        std::thread(&BlackmagicRAWDiskCache::writer, this).detach();
+        _writerStarted = true;
+    }
+    _queueCondition.notify_one();
+}
+
+bool BlackmagicRAWDiskCache::contains(const BlackmagicRAWFrameCache::Key &key)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    loadLocked();
+    return !_directory.empty() && _entries.count(getName(key)) > 0;
+}
+
+void BlackmagicRAWDiskCache::setDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (directory == _directory) { return; }
+    _directory = directory;
+    _loaded = false;
+    _entries.clear();
+    _size = 0;
+    // the frame being written stays counted until writer() is done with it
+    for (size_t i = 0; i < _queue.size(); ++i) {
+        _queueSize -= _queue[i].second->sizeBytes();
+    }
+    _queue.clear();
+}
+
+std::string BlackmagicRAWDiskCache::directory()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _directory;
+}
+
+void BlackmagicRAWDiskCache::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _budget = bytes;
+    loadLocked();
+    collectLocked();
+}
+
+size_t BlackmagicRAWDiskCache::budget()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _budget;
+}
+
+size_t BlackmagicRAWDiskCache::sizeBytes()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    loadLocked();
+    return _size;
+}
+
+void BlackmagicRAWDiskCache::loadLocked()
+{
+    if (_loaded || _directory.empty()) { return; }
+    _loaded = true;
+#ifdef _WIN32
+    _mkdir(_directory.c_str());
+#else
+    mkdir(_directory.c_str(), 0700);
+#endif
+
+    long long now = (long long)time(nullptr);
+    std::vector<std::string> stale;
+    std::function<void(const std::string&, long long, long long)> visit = [&](const std::string &name,
+                                                                             long long size,
+                                                                             long long mtime) {
+        if (endsWith(name, kDiskCacheSuffix)) {
+            Entry entry;
+            entry.sizeBytes = (size_t)size;
+            entry.lastUse = mtime;
+            addLocked(name, entry);
+        } else if (endsWith(name, kDiskCacheTmpSuffix) && now - mtime > kDiskCacheStaleSeconds) {
+            stale.push_back(name);
+        }
+    };
+#ifdef _WIN32
+    struct _finddata_t data;
+    intptr_t handle = _findfirst(joinPath(_directory, "*").c_str(), &data);
+    if (handle != -1) {
+        do {
+            visit(data.name, (long long)data.size, (long long)data.time_write);
+        } while (_findnext(handle, &data) == 0);
+        _findclose(handle);
+    }
+#else
+    DIR *dir = opendir(_directory.c_str());
+    if (dir != nullptr) {
+        struct dirent *item;
+        while ((item = readdir(dir)) != nullptr) {
+            std::string name(item->d_name);
+            struct stat info;
+            if (stat(joinPath(_directory, name).c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+                visit(name, (long long)info.st_size, (long long)info.st_mtime);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    for (size_t i = 0; i < stale.size(); ++i) {
+        remove(joinPath(_directory, stale[i]).c_str());
+    }
+    collectLocked();
+}
+
+void BlackmagicRAWDiskCache::addLocked(const std::string &name,
+                                       const Entry &entry)
+{
+    removeLocked(name);
+    Entry &added = _entries[name];
+    added = entry;
+    added.sequence = ++_sequence;
+    _size += entry.sizeBytes;
+}
+
+void BlackmagicRAWDiskCache::removeLocked(const std::string &name)
+{
+    std::unordered_map<std::string, Entry>::iterator it = _entries.find(name);
+    if (it == _entries.end()) { return; }
+    _size -= it->second.sizeBytes;
+    _entries.erase(it);
+}
+
+void BlackmagicRAWDiskCache::collectLocked()
+{
+    if (_size <= _budget) { return; }
+    std::vector<std::pair<std::pair<long long, uint64_t>, std::string> > order;
+    order.reserve(_entries.size());
+    for (std::unordered_map<std::string, Entry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        order.push_back(std::make_pair(std::make_pair(it->second.lastUse, it->second.sequence), it->first));
+    }
+    std::sort(order.begin(), order.end());
+    size_t target = (size_t)(_budget * kDiskCacheCollectRatio);
+    for (size_t i = 0; i < order.size() && _size > target; ++i) {
+        remove(joinPath(_directory, order[i].second).c_str());
+        removeLocked(order[i].second);
+    }
+}
+
+bool BlackmagicRAWDiskCache::store(const BlackmagicRAWFrameCache::Key &key,
+                                   const BlackmagicRAWFramePtr &frame)
+{
+    if (!frame) { return false; }
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        loadLocked();
+        if (_directory.empty() || getFileBytes(*frame) > _budget) { return false; }
+        directory = _directory;
+    }
+
+    // written aside and renamed into place once complete, other
+    // processes may share the directory
+    std::string name = getName(key);
+    std::string filename = joinPath(directory, name);
+    std::ostringstream tmp;
+#ifdef _WIN32
+    tmp << filename << '.' << _getpid() << '.' << std::this_thread::get_id() << kDiskCacheTmpSuffix;
+#else
+    tmp << filename << '.' << getpid() << '.' << std::this_thread::get_id() << kDiskCacheTmpSuffix;
+#endif
+    std::string header = getHeader(key, *frame);
+    FILE *file = header.empty() ? nullptr : fopen(tmp.str().c_str(), "wb");
+    if (file == nullptr) { return false; }
+    bool written = fwrite(header.data(), 1, header.size(), file) == header.size() &&
+                   writePixels(file, *frame);
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    if (written) { remove(filename.c_str()); }
+#endif
+    if (!written || rename(tmp.str().c_str(), filename.c_str()) != 0) {
+        remove(tmp.str().c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (directory == _directory) {
+        Entry entry;
+        entry.sizeBytes = getFileBytes(*frame);
+        entry.lastUse = (long long)time(nullptr);
+        addLocked(name, entry);
+        collectLocked();
+    }
+    return true;
+}
+
+void BlackmagicRAWDiskCache::writer()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _queueCondition.wait(lock, [&]() { return !_queue.empty(); });
+        Job job = _queue.front();
+        _queue.pop_front();
+        lock.unlock();
+        store(job.first, job.second);
+        size_t bytes = job.second->sizeBytes();
+        job.second.reset();
+        lock.lock();
+        _queueSize -= bytes;
+    }
+}
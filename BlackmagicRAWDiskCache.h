@@ -0,0 +1,105 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWDISKCACHE_H
+#define BLACKMAGICRAWDISKCACHE_H
+
+#include "BlackmagicRAWFrameCache.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Persistent frame cache in a local directory, shared by all sessions of the
+ * user and kept across them.
+ *
+ * Every frame is a single file named after a hash of its frame cache key. The
+ * key is repeated in a one page header, followed by the RGBF32 pixels at a page
+ * aligned offset, so a frame is read back by memory mapping the file. Frames
+ * are written by a background thread into a temporary file renamed once
+ * complete, readers never see a partial frame. The directory is kept under its
+ * budget by removing the least recently read frames.
+ */
+class BlackmagicRAWDiskCache
+{
+public:
+    static BlackmagicRAWDiskCache& instance();
+
+    // frame from disk, empty if it isn't there or the cache is disabled
+    BlackmagicRAWFramePtr read(const BlackmagicRAWFrameCache::Key &key);
+    // queue a frame to be written, dropped when the writer can't keep up.
+    // Frames of both formats are written as RGBF32
+    void write(const BlackmagicRAWFrameCache::Key &key,
+               const BlackmagicRAWFramePtr &frame);
+    // write a frame on the calling thread, false if it couldn't be written
+    bool store(const BlackmagicRAWFrameCache::Key &key,
+               const BlackmagicRAWFramePtr &frame);
+    // cheap check against the index of the directory, no file access
+    bool contains(const BlackmagicRAWFrameCache::Key &key);
+
+    // empty disables the cache
+    void setDirectory(const std::string &directory);
+    std::string directory();
+    void setBudget(size_t bytes);
+    size_t budget();
+    size_t sizeBytes();
+
+private:
+    struct Entry
+    {
+        size_t sizeBytes = 0;
+        long long lastUse = 0; // seconds, modification time on disk
+        uint64_t sequence = 0; // order of uses within this process
+    };
+    typedef std::pair<BlackmagicRAWFrameCache::Key, BlackmagicRAWFramePtr> Job;
+
+    BlackmagicRAWDiskCache();
+    BlackmagicRAWDiskCache(const BlackmagicRAWDiskCache&) = delete;
+    BlackmagicRAWDiskCache& operator=(const BlackmagicRAWDiskCache&) = delete;
+    static std::string getName(const BlackmagicRAWFrameCache::Key &key);
+    void loadLocked();
+    void addLocked(const std::string &name,
+                   const Entry &entry);
+    void removeLocked(const std::string &name);
+    // remove least recently read frames until the directory is under budget
+    void collectLocked();
+    // writes queued frames, runs on its own thread
+    void writer();
+
+    std::mutex _mutex;
+    std::string _directory;
+    size_t _budget;
+    size_t _size;
+    uint64_t _sequence;
+    bool _loaded;
+    std::unordered_map<std::string, Entry> _entries; // by file name
+    std::deque<Job> _queue;
+    size_t _queueSize; // of _queue and the frame being written
+    std::condition_variable _queueCondition;
+    bool _writerStarted;
+};
+
+#endif // BLACKMAGICRAWDISKCACHE_H
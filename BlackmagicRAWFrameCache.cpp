@@ -0,0 +1,566 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWFrameCache.h"
+#include "BlackmagicRAWBufferPool.h"
+#include "BlackmagicRAWCompressedFrame.h"
+#include "BlackmagicRAWDiskCache.h"
+#include "BlackmagicRAWResourceManager.h"
+#include "BlackmagicRAWTransfer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <thread>
+
+#define kFrameCacheDefaultBudget ((size_t)2048 << 20)
+#define kCompressedCacheDefaultBudget ((size_t)1024 << 20)
+// free pool buffers kept when the budget is lower, for the bit streams and
+// images of decodes that still run without a cache
+#define kPoolRetainMinimum ((size_t)512 << 20)
+// evicted frames waiting to be compressed, more are dropped
+#define kDemoteQueueLength 4
+// interval at which waits for a decode in flight check for an abort
+#define kAbortPollMilliseconds 5
+// levels above the requested one read from disk to derive it, a level more
+// is four times the pixels to read and halve
+#define kDiskDeriveLevels 1
+
+BlackmagicRAWFrame::BlackmagicRAWFrame(int width,
+                                       int height,
+                                       Format format)
+: _width(width)
+, _height(height)
+, _format(format)
+, _storage(BlackmagicRAWResourceManager::allocate(sizeBytes()))
+{
+    if (!_storage) { throw std::bad_alloc(); }
+}
+
+BlackmagicRAWFrame::BlackmagicRAWFrame(int width,
+                                       int height,
+                                       const std::shared_ptr<char> &storage)
+: _width(width)
+, _height(height)
+, _format(formatRGBF32)
+, _storage(storage)
+{
+}
+
+namespace {
+// result of a decode in flight, empty once abortCallback returns true
+BlackmagicRAWFramePtr waitFor(const std::shared_future<BlackmagicRAWFramePtr> &future,
+                              const BlackmagicRAWFrameCache::AbortCallback &abortCallback)
+{
+    if (abortCallback) {
+        while (future.wait_for(std::chrono::milliseconds(kAbortPollMilliseconds)) != std::future_status::ready) {
+            if (abortCallback()) { return BlackmagicRAWFramePtr(); }
+        }
+    }
+    return future.get();
+}
+
+// the frame as stored in the cache, empty if there's no memory for it
+BlackmagicRAWFramePtr pack(const BlackmagicRAWFramePtr &frame,
+                           bool halfFloat)
+{
+    if (!frame || !halfFloat || frame->format() == BlackmagicRAWFrame::formatRGBF16) { return frame; }
+    try {
+        std::shared_ptr<BlackmagicRAWFrame> packed = std::make_shared<BlackmagicRAWFrame>(frame->width(),
+                                                                                          frame->height(),
+                                                                                          BlackmagicRAWFrame::formatRGBF16);
+        size_t rowCount = (size_t)frame->width() * 3;
+        BlackmagicRAWTransfer::forEachStrip(frame->height(), [&](int begin, int end) {
+            BlackmagicRAWTransfer::packHalf(frame->data() + begin * rowCount,
+                                            packed->halfData() + begin * rowCount,
+                                            (end - begin) * rowCount);
+        });
+        return packed;
+    } catch (const std::bad_alloc&) {
+        return BlackmagicRAWFramePtr();
+    }
+}
+
+// frame in memory of our own, empty if there's no memory for it
+BlackmagicRAWFramePtr copy(const BlackmagicRAWFramePtr &frame)
+{
+    if (!frame) { return frame; }
+    try {
+        std::shared_ptr<BlackmagicRAWFrame> copied = std::make_shared<BlackmagicRAWFrame>(frame->width(),
+                                                                                          frame->height(),
+                                                                                          frame->format());
+        size_t rowBytes = frame->sizeBytes() / std::max(1, frame->height());
+        BlackmagicRAWTransfer::forEachStrip(frame->height(), [&](int begin, int end) {
+            std::memcpy((char*)copied->data() + begin * rowBytes,
+                        (const char*)frame->data() + begin * rowBytes,
+                        (end - begin) * rowBytes);
+        });
+        return copied;
+    } catch (const std::bad_alloc&) {
+        return BlackmagicRAWFramePtr();
+    }
+}
+
+// RGBF32 frame of a stored one, throws std::bad_alloc
+BlackmagicRAWFramePtr unpack(const BlackmagicRAWFramePtr &frame)
+{
+    if (!frame || frame->format() == BlackmagicRAWFrame::formatRGBF32) { return frame; }
+    std::shared_ptr<BlackmagicRAWFrame> unpacked = std::make_shared<BlackmagicRAWFrame>(frame->width(), frame->height());
+    size_t rowCount = (size_t)frame->width() * 3;
+    BlackmagicRAWTransfer::forEachStrip(frame->height(), [&](int begin, int end) {
+        BlackmagicRAWTransfer::unpackHalf(frame->halfData() + begin * rowCount,
+                                          unpacked->data() + begin * rowCount,
+                                          (end - begin) * rowCount);
+    });
+    return unpacked;
+}
+
+// unpack, empty if there's no memory for it
+BlackmagicRAWFramePtr retrieve(const BlackmagicRAWFramePtr &stored)
+{
+    try {
+        return unpack(stored);
+    } catch (const std::bad_alloc&) {
+        return BlackmagicRAWFramePtr();
+    }
+}
+
+// free pool buffers are kept up to the cache budget, so the buffers of
+// frames as large as the cache can hold are reused
+void setPoolRetainLimit(size_t budget)
+{
+    BlackmagicRAWBufferPool::instance().setRetainLimit(std::max(budget, kPoolRetainMinimum));
+}
+}
+
+size_t BlackmagicRAWFrameCache::KeyHash::operator()(const Key &key) const
+{
+    size_t hash = std::hash<std::string>()(key.file.filename);
+    hash ^= std::hash<long long>()(key.file.size) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<long long>()(key.file.mtime) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<long long>()(key.file.sidecarMtime) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<uint64_t>()(key.frame) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<int>()(key.quality) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<uint64_t>()(key.processingHash) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+BlackmagicRAWFrameCache& BlackmagicRAWFrameCache::instance()
+{
+    // never destroyed, its demotion thread runs for the lifetime of the process
+    static BlackmagicRAWFrameCache* cache = new BlackmagicRAWFrameCache();
+    return *cache;
+}
+
+BlackmagicRAWFrameCache::BlackmagicRAWFrameCache()
+: _budget(kFrameCacheDefaultBudget)
+, _halfFloat(false)
+, _size(0)
+, _compressedBudget(kCompressedCacheDefaultBudget)
+, _compressedSize(0)
+, _demotingSize(0)
+, _demoteThreadStarted(false)
+{
+    setPoolRetainLimit(_budget);
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::get(const Key &key)
+{
+    BlackmagicRAWFramePtr stored;
+    BlackmagicRAWCompressedFramePtr compressed;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        stored = findLocked(key, &compressed);
+    }
+    if (compressed) { stored = promote(key, compressed); }
+    return retrieve(stored);
+}
+
+bool BlackmagicRAWFrameCache::contains(const Key &key)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_index.count(key) || _compressedIndex.count(key)) { return true; }
+    for (EntryList::const_iterator it = _demoting.begin(); it != _demoting.end(); ++it) {
+        if (it->first == key) { return true; }
+    }
+    return false;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::findLocked(const Key &key,
+                                                         BlackmagicRAWCompressedFramePtr *compressed)
+{
+    BlackmagicRAWFramePtr frame = getLocked(key);
+    if (frame) { return frame; }
+
+    // not compressed yet, it goes straight back
+    for (EntryList::iterator it = _demoting.begin(); it != _demoting.end(); ++it) {
+        if (it->first == key) {
+            frame = it->second;
+            _demotingSize -= frame->sizeBytes();
+            _demoting.erase(it);
+            insertLocked(key, frame);
+            return frame;
+        }
+    }
+
+    std::unordered_map<Key, CompressedList::iterator, KeyHash>::iterator it = _compressedIndex.find(key);
+    if (it != _compressedIndex.end()) {
+        *compressed = it->second->second;
+        _compressedSize -= (*compressed)->sizeBytes();
+        _compressedEntries.erase(it->second);
+        _compressedIndex.erase(it);
+    }
+    return frame;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::promote(const Key &key,
+                                                      const BlackmagicRAWCompressedFramePtr &compressed)
+{
+    BlackmagicRAWFramePtr frame;
+    try {
+        frame = compressed->decompress();
+    } catch (const std::bad_alloc&) {
+        return BlackmagicRAWFramePtr();
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    insertLocked(key, frame);
+    return frame;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::getLocked(const Key &key)
+{
+    std::unordered_map<Key, EntryList::iterator, KeyHash>::iterator it = _index.find(key);
+    if (it == _index.end()) { return BlackmagicRAWFramePtr(); }
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return it->second->second;
+}
+
+void BlackmagicRAWFrameCache::insert(const Key &key,
+                                     const BlackmagicRAWFramePtr &frame)
+{
+    // inserted frames are fresh decodes, kept on disk for later sessions too.
+    // The writer gets the frame as stored here, so it holds no copy of its own
+    BlackmagicRAWFramePtr stored = pack(frame, halfFloat());
+    BlackmagicRAWDiskCache::instance().write(key, stored ? stored : frame);
+    std::lock_guard<std::mutex> lock(_mutex);
+    insertLocked(key, stored);
+}
+
+bool BlackmagicRAWFrameCache::insertCopy(const Key &key,
+                                         const BlackmagicRAWFramePtr &frame)
+{
+    if (!frame) { return false; }
+    bool packed = halfFloat() && frame->format() == BlackmagicRAWFrame::formatRGBF32;
+    size_t bytes = packed ? frame->sizeBytes() / 2 : frame->sizeBytes();
+    if (bytes > budget()) { return false; }
+    BlackmagicRAWFramePtr stored = packed ? pack(frame, true) : copy(frame);
+    if (!stored) { return false; }
+    BlackmagicRAWDiskCache::instance().write(key, stored);
+    std::lock_guard<std::mutex> lock(_mutex);
+    insertLocked(key, stored);
+    return true;
+}
+
+void BlackmagicRAWFrameCache::insertLocked(const Key &key,
+                                           const BlackmagicRAWFramePtr &frame)
+{
+    if (!frame) { return; }
+    std::unordered_map<Key, EntryList::iterator, KeyHash>::iterator it = _index.find(key);
+    if (it != _index.end()) {
+        _size -= it->second->second->sizeBytes();
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+    size_t bytes = frame->sizeBytes();
+    if (bytes > _budget) { return; }
+    evictLocked(_budget - bytes);
+    _entries.push_front(Entry(key, frame));
+    _index[key] = _entries.begin();
+    _size += bytes;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::getOrDecode(const Key &key,
+                                                         const std::function<BlackmagicRAWFramePtr()> &decode,
+                                                         const AbortCallback &abortCallback)
+{
+    std::promise<BlackmagicRAWFramePtr> promise;
+    for (;;) {
+        std::shared_future<BlackmagicRAWFramePtr> future;
+        BlackmagicRAWFramePtr stored;
+        BlackmagicRAWCompressedFramePtr compressed;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            stored = findLocked(key, &compressed);
+            if (!stored && !compressed) {
+                std::unordered_map<Key, std::shared_future<BlackmagicRAWFramePtr>, KeyHash>::const_iterator it = _inFlight.find(key);
+                if (it == _inFlight.end()) {
+                    _inFlight[key] = promise.get_future().share();
+                    break;
+                }
+                future = it->second;
+            }
+        }
+        if (compressed) { stored = promote(key, compressed); }
+        if (stored) { return retrieve(stored); }
+        // the decode we waited for failed or was aborted, try our own
+        BlackmagicRAWFramePtr frame = waitFor(future, abortCallback);
+        if (frame || (abortCallback && abortCallback())) { return frame; }
+    }
+
+    // waiters get an empty frame if decode fails and retry themselves
+    BlackmagicRAWFramePtr frame;
+    bool decoded = false;
+    try {
+        // the exact level on disk (a proxy) beats deriving it from a larger one
+        BlackmagicRAWDiskCache &disk = BlackmagicRAWDiskCache::instance();
+        if (disk.contains(key)) { frame = disk.read(key); }
+        if (!frame) { frame = derive(key); }
+        if (!frame) {
+            frame = decode();
+            decoded = true;
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _inFlight.erase(key);
+        }
+        promise.set_value(BlackmagicRAWFramePtr());
+        throw;
+    }
+    BlackmagicRAWFramePtr stored = pack(frame, halfFloat());
+    if (decoded) { BlackmagicRAWDiskCache::instance().write(key, stored ? stored : frame); }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        insertLocked(key, stored);
+        _inFlight.erase(key);
+    }
+    promise.set_value(frame);
+    return frame;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::waitInFlight(const Key &key,
+                                                          const AbortCallback &abortCallback)
+{
+    std::shared_future<BlackmagicRAWFramePtr> future;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unordered_map<Key, std::shared_future<BlackmagicRAWFramePtr>, KeyHash>::const_iterator it = _inFlight.find(key);
+        if (it == _inFlight.end()) { return BlackmagicRAWFramePtr(); }
+        future = it->second;
+    }
+    return waitFor(future, abortCallback);
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWFrameCache::derive(const Key &key)
+{
+    BlackmagicRAWFramePtr source;
+    Key level = key;
+    // the nearest level wins, in memory or on disk
+    for (int quality = key.quality - 1; quality >= BlackmagicRAWHandler::rawFullQuality && !source; --quality) {
+        level.quality = quality;
+        BlackmagicRAWCompressedFramePtr compressed;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            source = findLocked(level, &compressed);
+        }
+        if (compressed) { source = promote(level, compressed); }
+        // proxies in the disk cache are levels to start from as well, unless
+        // reading a much larger frame costs more than decoding
+        if (!source && key.quality - quality <= kDiskDeriveLevels &&
+            BlackmagicRAWDiskCache::instance().contains(level)) {
+            source = BlackmagicRAWDiskCache::instance().read(level);
+        }
+    }
+    if (!source) { return BlackmagicRAWFramePtr(); }
+
+    // one level at a time, so each one is there for the next request
+    try {
+        source = unpack(source);
+        while (level.quality < key.quality) {
+            std::shared_ptr<BlackmagicRAWFrame> half = std::make_shared<BlackmagicRAWFrame>(std::max(1, source->width() / 2),
+                                                                                            std::max(1, source->height() / 2));
+            BlackmagicRAWTransfer::halveRGB(source->data(), source->width(), source->height(), half->data());
+            ++level.quality;
+            source = half;
+            // not written to disk, it's cheaper to derive again
+            BlackmagicRAWFramePtr stored = pack(source, halfFloat());
+            std::lock_guard<std::mutex> lock(_mutex);
+            insertLocked(level, stored);
+        }
+    } catch (const std::bad_alloc&) {
+        return BlackmagicRAWFramePtr();
+    }
+    return source;
+}
+
+void BlackmagicRAWFrameCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _index.clear();
+    _entries.clear();
+    _size = 0;
+    clearDemotingLocked();
+    _compressedIndex.clear();
+    _compressedEntries.clear();
+    _compressedSize = 0;
+}
+
+void BlackmagicRAWFrameCache::setBudget(size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _budget = bytes;
+        evictLocked(_budget);
+    }
+    setPoolRetainLimit(bytes);
+}
+
+void BlackmagicRAWFrameCache::setHalfFloat(bool halfFloat)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _halfFloat = halfFloat;
+}
+
+bool BlackmagicRAWFrameCache::halfFloat()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _halfFloat;
+}
+
+size_t BlackmagicRAWFrameCache::budget()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _budget;
+}
+
+size_t BlackmagicRAWFrameCache::sizeBytes()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _size;
+}
+
+void BlackmagicRAWFrameCache::setCompressedBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _compressedBudget = bytes;
+    if (_compressedBudget == 0) { clearDemotingLocked(); }
+    evictCompressedLocked(_compressedBudget > _demotingSize ? _compressedBudget - _demotingSize : 0);
+}
+
+size_t BlackmagicRAWFrameCache::compressedBudget()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _compressedBudget;
+}
+
+size_t BlackmagicRAWFrameCache::compressedSizeBytes()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _compressedSize + _demotingSize;
+}
+
+void BlackmagicRAWFrameCache::evictLocked(size_t budget)
+{
+    while (_size > budget && !_entries.empty()) {
+        EntryList::iterator last = std::prev(_entries.end());
+        size_t bytes = last->second->sizeBytes();
+        _size -= bytes;
+        _index.erase(last->first);
+        // demoted to the compressed tier, unless it can't keep up. Until it's
+        // compressed the whole frame is charged to that tier
+        if (_demoting.size() < kDemoteQueueLength && _demotingSize + bytes <= _compressedBudget) {
+            evictCompressedLocked(_compressedBudget - _demotingSize - bytes);
+            _demotingSize += bytes;
+            _demoting.splice(_demoting.end(), _entries, last);
+            if (!_demoteThreadStarted) {
+                std::thread(&BlackmagicRAWFrameCache::demote, this).detach();
+                _demoteThreadStarted = true;
+            }
+            _demoteCondition.notify_one();
+        } else {
+            _entries.erase(last);
+        }
+    }
+}
+
+void BlackmagicRAWFrameCache::insertCompressedLocked(const Key &key,
+                                                     const BlackmagicRAWCompressedFramePtr &compressed)
+{
+    std::unordered_map<Key, CompressedList::iterator, KeyHash>::iterator it = _compressedIndex.find(key);
+    if (it != _compressedIndex.end()) {
+        _compressedSize -= it->second->second->sizeBytes();
+        _compressedEntries.erase(it->second);
+        _compressedIndex.erase(it);
+    }
+    size_t bytes = compressed->sizeBytes();
+    if (bytes + _demotingSize > _compressedBudget) { return; }
+    evictCompressedLocked(_compressedBudget - _demotingSize - bytes);
+    _compressedEntries.push_front(CompressedEntry(key, compressed));
+    _compressedIndex[key] = _compressedEntries.begin();
+    _compressedSize += bytes;
+}
+
+void BlackmagicRAWFrameCache::evictCompressedLocked(size_t budget)
+{
+    while (_compressedSize > budget && !_compressedEntries.empty()) {
+        const CompressedEntry &entry = _compressedEntries.back();
+        _compressedSize -= entry.second->sizeBytes();
+        _compressedIndex.erase(entry.first);
+        _compressedEntries.pop_back();
+    }
+}
+
+void BlackmagicRAWFrameCache::clearDemotingLocked()
+{
+    // the frame being compressed stays charged until demote() is done with it
+    for (EntryList::const_iterator it = _demoting.begin(); it != _demoting.end(); ++it) {
+        _demotingSize -= it->second->sizeBytes();
+    }
+    _demoting.clear();
+}
+
+void BlackmagicRAWFrameCache::demote()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _demoteCondition.wait(lock, [&]() { return !_demoting.empty(); });
+        Entry entry = _demoting.front();
+        _demoting.pop_front();
+        lock.unlock();
+        BlackmagicRAWCompressedFramePtr compressed;
+        try {
+            compressed = BlackmagicRAWCompressedFrame::compress(*entry.second);
+        } catch (const std::bad_alloc&) {
+        }
+        size_t bytes = entry.second->sizeBytes();
+        entry.second.reset();
+        lock.lock();
+        _demotingSize -= bytes;
+        // skipped if the frame was inserted again in the meantime
+        if (compressed && _compressedBudget > 0 && _index.find(entry.first) == _index.end()) {
+            insertCompressedLocked(entry.first, compressed);
+        }
+    }
+}
@@ -0,0 +1,204 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWFRAMECACHE_H
+#define BLACKMAGICRAWFRAMECACHE_H
+
+#include "BlackmagicRAWHandler.h"
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// a processed RGB frame, RGBF32 unless it's stored in the frame cache as half floats
+class BlackmagicRAWFrame
+{
+public:
+    enum Format
+    {
+        formatRGBF32,
+        formatRGBF16
+    };
+
+    // allocates the pixels
+    BlackmagicRAWFrame(int width,
+                       int height,
+                       Format format = formatRGBF32);
+    // uses the given buffer, storage keeps it alive
+    BlackmagicRAWFrame(int width,
+                       int height,
+                       const std::shared_ptr<char> &storage);
+    int width() const { return _width; }
+    int height() const { return _height; }
+    Format format() const { return _format; }
+    const float* data() const { return (const float*)_storage.get(); }
+    float* data() { return (float*)_storage.get(); }
+    const uint16_t* halfData() const { return (const uint16_t*)_storage.get(); }
+    uint16_t* halfData() { return (uint16_t*)_storage.get(); }
+    size_t sizeBytes() const { return (size_t)_width * _height * 3 * (_format == formatRGBF16 ? sizeof(uint16_t) : sizeof(float)); }
+private:
+    int _width;
+    int _height;
+    Format _format;
+    std::shared_ptr<char> _storage;
+};
+
+typedef std::shared_ptr<const BlackmagicRAWFrame> BlackmagicRAWFramePtr;
+
+class BlackmagicRAWCompressedFrame;
+typedef std::shared_ptr<const BlackmagicRAWCompressedFrame> BlackmagicRAWCompressedFramePtr;
+
+/*
+ * Process-wide decoded frame cache shared by all plugin instances.
+ *
+ * Frames are keyed on the file identity, frame index, decode quality and the
+ * processing hash of the specs. The budget is enforced in bytes, least
+ * recently used frames are evicted first. The qualities of a frame form a
+ * resolution pyramid: a missing lower level is built from a higher one
+ * instead of being decoded again.
+ *
+ * Frames can optionally be kept as half floats, which doubles the number of
+ * frames the budget holds. They are packed on insertion and unpacked on
+ * retrieval, callers always get RGBF32 frames.
+ *
+ * Frames evicted from this hot tier are losslessly compressed on a
+ * background thread into a second tier with a budget of its own, and
+ * decompressed back into the hot tier when they are requested again.
+ */
+class BlackmagicRAWFrameCache
+{
+public:
+    struct Key
+    {
+        BlackmagicRAWHandler::FileIdentity file;
+        uint64_t frame = 0;
+        int quality = BlackmagicRAWHandler::rawFullQuality;
+        uint64_t processingHash = 0;
+        bool operator==(const Key &other) const
+        {
+            return file == other.file && frame == other.frame &&
+                   quality == other.quality && processingHash == other.processingHash;
+        }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    // polled while waiting for a decode in flight, returns true when the caller gave up
+    typedef std::function<bool()> AbortCallback;
+
+    static BlackmagicRAWFrameCache& instance();
+
+    BlackmagicRAWFramePtr get(const Key &key);
+    // whether a tier holds the frame, without unpacking, promoting or
+    // touching its recency
+    bool contains(const Key &key);
+    void insert(const Key &key,
+                const BlackmagicRAWFramePtr &frame);
+    // insert a copy of a frame in memory the cache can't keep (the host's
+    // buffer), as stored: a half float cache makes the copy while packing.
+    // False if the frame isn't kept
+    bool insertCopy(const Key &key,
+                    const BlackmagicRAWFramePtr &frame);
+    void clear();
+
+    // cached frame, or decode it once for all concurrent callers of the same
+    // key: the first one reads it from the disk cache, derives it from a
+    // higher resolution level or runs decode, and caches the frame, the others
+    // wait for its result. Waiting ends with an empty frame once abortCallback
+    // returns true, the decode goes on for the others
+    BlackmagicRAWFramePtr getOrDecode(const Key &key,
+                                      const std::function<BlackmagicRAWFramePtr()> &decode,
+                                      const AbortCallback &abortCallback = AbortCallback());
+    // result of a decode already in flight for key, empty if there is none or
+    // once abortCallback returns true
+    BlackmagicRAWFramePtr waitInFlight(const Key &key,
+                                       const AbortCallback &abortCallback = AbortCallback());
+    // the frame at a lower quality, box downsampled from the nearest cached
+    // higher resolution level of the same frame, on disk only from the next
+    // level up. The levels in between are cached as well. Empty if no higher
+    // level is cached
+    BlackmagicRAWFramePtr derive(const Key &key);
+
+    // also the free memory the buffer pool keeps for reuse
+    void setBudget(size_t bytes);
+    size_t budget();
+    // store frames inserted from now on as half floats
+    void setHalfFloat(bool halfFloat);
+    bool halfFloat();
+    // budget of the compressed tier, 0 drops evicted frames. Frames waiting
+    // to be compressed count against it at their full size
+    void setCompressedBudget(size_t bytes);
+    size_t compressedBudget();
+    size_t compressedSizeBytes();
+    size_t sizeBytes();
+
+private:
+    BlackmagicRAWFrameCache();
+    BlackmagicRAWFramePtr getLocked(const Key &key);
+    // stored frame of the hot tier, or the compressed one taken out of the
+    // compressed tier for promote()
+    BlackmagicRAWFramePtr findLocked(const Key &key,
+                                     BlackmagicRAWCompressedFramePtr *compressed);
+    // decompress a frame back into the hot tier
+    BlackmagicRAWFramePtr promote(const Key &key,
+                                  const BlackmagicRAWCompressedFramePtr &compressed);
+    void insertLocked(const Key &key,
+                      const BlackmagicRAWFramePtr &frame);
+    void evictLocked(size_t budget);
+    void insertCompressedLocked(const Key &key,
+                                const BlackmagicRAWCompressedFramePtr &compressed);
+    void evictCompressedLocked(size_t budget);
+    void clearDemotingLocked();
+    // compresses evicted frames, runs on its own thread
+    void demote();
+
+    typedef std::pair<Key, BlackmagicRAWFramePtr> Entry;
+    typedef std::list<Entry> EntryList;
+    typedef std::pair<Key, BlackmagicRAWCompressedFramePtr> CompressedEntry;
+    typedef std::list<CompressedEntry> CompressedList;
+
+    std::mutex _mutex;
+    size_t _budget;
+    bool _halfFloat;
+    size_t _size;
+    EntryList _entries; // most recently used first
+    std::unordered_map<Key, EntryList::iterator, KeyHash> _index;
+    std::unordered_map<Key, std::shared_future<BlackmagicRAWFramePtr>, KeyHash> _inFlight;
+
+    size_t _compressedBudget;
+    size_t _compressedSize;
+    CompressedList _compressedEntries; // most recently used first
+    std::unordered_map<Key, CompressedList::iterator, KeyHash> _compressedIndex;
+    EntryList _demoting; // evicted, waiting to be compressed
+    size_t _demotingSize; // of _demoting and the frame being compressed
+    std::condition_variable _demoteCondition;
+    bool _demoteThreadStarted;
+};
+
+#endif // BLACKMAGICRAWFRAMECACHE_H
@@ -22,6 +22,24 @@
 */
 
 #include "BlackmagicRAWHandler.h"
+#include "BlackmagicRAWClipIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 #ifdef _WIN32
 #include "BlackmagicRawAPI_i.c"
@@ -30,12 +48,108 @@
 #define BMVAR Variant
 #endif
 
+namespace {
+// numeric clip metadata, false if missing or not a number
+bool getClipMetadataNumber(IBlackmagicRawClip *clip,
+                           const std::string &key,
+                           double *value)
+{
+    BMVAR var;
+#ifdef _WIN32
+    VariantInit(&var);
+    std::wstring wkey(key.begin(), key.end());
+    BSTR bkey = SysAllocStringLen(wkey.data(), wkey.size());
+    HRESULT result = clip->GetMetadata(bkey, &var);
+    SysFreeString(bkey);
+    if (result != S_OK) { return false; }
+    bool found = true;
+    switch (var.vt) {
+    case VT_I2: *value = var.iVal; break;
+    case VT_UI2: *value = var.uiVal; break;
+    case VT_I4: *value = var.lVal; break;
+    case VT_UI4: *value = var.ulVal; break;
+    case VT_R4: *value = var.fltVal; break;
+    default: found = false;
+    }
+    VariantClear(&var);
+    return found;
+#else
+#ifdef __APPLE__
+    CFStringRef cfkey = CFStringCreateWithCString(kCFAllocatorDefault, key.c_str(), kCFStringEncodingUTF8);
+    HRESULT result = clip->GetMetadata(cfkey, &var);
+    CFRelease(cfkey);
+#else
+    HRESULT result = clip->GetMetadata(key.c_str(), &var);
+#endif
+    if (result != S_OK) { return false; }
+    switch (var.vt) {
+    case blackmagicRawVariantTypeS16: *value = var.iVal; break;
+    case blackmagicRawVariantTypeU16: *value = var.uiVal; break;
+    case blackmagicRawVariantTypeS32: *value = var.intVal; break;
+    case blackmagicRawVariantTypeU32: *value = var.uintVal; break;
+    case blackmagicRawVariantTypeFloat32: *value = var.fltVal; break;
+    default: return false;
+    }
+    return true;
+#endif
+}
+}
+
 const BlackmagicRAWHandler::BlackmagicRAWSpecs
 BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
-                                   const std::string &path)
+                                   const std::string &path,
+                                   std::string *error)
+{
+    if (error != nullptr) { error->clear(); }
+    if (filename.empty() || path.empty()) { return BlackmagicRAWSpecs(); }
+
+    // probed specs by filename, refreshed when the file changes on disk.
+    // never destroyed, may be used from other static destructors.
+    struct Entry
+    {
+        FileIdentity identity;
+        std::string path;
+        BlackmagicRAWSpecs specs;
+    };
+    static std::mutex* specsMutex = new std::mutex();
+    static std::map<std::string, Entry>* specsCache = new std::map<std::string, Entry>();
+
+    FileIdentity identity = getFileIdentity(filename);
+    {
+        std::lock_guard<std::mutex> lock(*specsMutex);
+        std::map<std::string, Entry>::const_iterator it = specsCache->find(filename);
+        if (it != specsCache->end() && it->second.identity == identity && it->second.path == path) {
+            return it->second.specs;
+        }
+    }
+
+    // probe outside the lock, through the SDK only for clips not in the
+    // persistent index. Failed probes aren't cached
+    BlackmagicRAWSpecs specs;
+    if (!BlackmagicRAWClipIndex::instance().find(filename, &specs)) {
+        specs = probeClipSpecs(filename, path, error);
+        if (specs.width > 0 && specs.height > 0) {
+            BlackmagicRAWClipIndex::instance().store(filename, specs);
+        }
+    }
+    if (specs.width > 0 && specs.height > 0 && identity.size >= 0) {
+        std::lock_guard<std::mutex> lock(*specsMutex);
+        Entry &entry = (*specsCache)[filename];
+        entry.identity = identity;
+        entry.path = path;
+        entry.specs = specs;
+    }
+    return specs;
+}
+
+const BlackmagicRAWHandler::BlackmagicRAWSpecs
+BlackmagicRAWHandler::probeClipSpecs(const std::string &filename,
+                                     const std::string &path,
+                                     std::string *error)
 {
     HRESULT result = S_OK;
     BlackmagicRAWSpecs specs;
+    std::string failure;
 
     if (filename.empty() || path.empty()) { return specs; }
 
@@ -57,27 +171,18 @@ BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
 
     do {
         // setup factory
-#ifdef _WIN32
-        std::wstring wpath(path.begin(), path.end());
-        BSTR libraryPath = SysAllocStringLen(wpath.data(), wpath.size());
-        factory = CreateBlackmagicRawFactoryInstanceFromPath(libraryPath);
-        SysFreeString(libraryPath);
-#elif __APPLE__
-        CFStringRef cfpath = CFStringCreateWithCString(kCFAllocatorDefault, path.c_str(), kCFStringEncodingUTF8);
-        factory = CreateBlackmagicRawFactoryInstanceFromPath(cfpath);
-        //CFRelease(cfpath);
-#else
-        factory = CreateBlackmagicRawFactoryInstanceFromPath(path.c_str());
-#endif
+        factory = acquireFactory(path);
         if (factory == nullptr){
-            std::cout << "Failed to create IBlackmagicRawFactory!" << std::endl;
+            failure = "Failed to create IBlackmagicRawFactory!";
+            std::cout << failure << std::endl;
             break;
         }
 
         // get codecs
         result = factory->CreateCodec(&codec);
         if (result != S_OK) {
-            std::cout << "Failed to create IBlackmagicRaw!" << std::endl;
+            failure = "Failed to create IBlackmagicRaw!";
+            std::cout << failure << std::endl;
             break;
         }
 
@@ -95,21 +200,24 @@ BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
         result = codec->OpenClip(filename.c_str(), &clip);
 #endif
         if (result != S_OK) {
-            std::cout << "Failed to open IBlackmagicRawClip!" << std::endl;
+            failure = "Failed to open IBlackmagicRawClip!";
+            std::cout << failure << std::endl;
             break;
         }
 
         // get camera type
         result = clip->GetCameraType(&cameraType);
         if (result != S_OK) {
-            std::cout << "Failed to get camera type" << std::endl;
+            failure = "Failed to get camera type";
+            std::cout << failure << std::endl;
             break;
         }
 
         // get constants
         result = codec->QueryInterface(IID_IBlackmagicRawConstants, (void**)&constants);
         if (result != S_OK) {
-            std::cout << "Failed to get constants" << std::endl;
+            failure = "Failed to get constants";
+            std::cout << failure << std::endl;
             break;
         }
 
@@ -255,7 +363,8 @@ BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
         // get clip attributes
         result = clip->CloneClipProcessingAttributes(&clipAttr);
         if (result != S_OK) {
-            std::cout << "Failed to get IBlackmagicRawClipProcessingAttributes!" << std::endl;
+            failure = "Failed to get IBlackmagicRawClipProcessingAttributes!";
+            std::cout << failure << std::endl;
             break;
         }
 
@@ -300,17 +409,36 @@ BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
                                             &whiteLevel);
         specs.whiteLevel = whiteLevel.fltVal;
 
+        // as-shot frame attributes from the clip metadata when present,
+        // so the probe doesn't need to read a frame
+        double colorTemp = 0;
+        double tint = 0;
+        double exposure = 0;
+        double iso = 0;
+        if (getClipMetadataNumber(clip, "white_balance_kelvin", &colorTemp) &&
+            getClipMetadataNumber(clip, "white_balance_tint", &tint) &&
+            getClipMetadataNumber(clip, "exposure", &exposure) &&
+            getClipMetadataNumber(clip, "iso", &iso)) {
+            callback.specs.colorTemp = (int)colorTemp;
+            callback.specs.tint = (int)tint;
+            callback.specs.exposure = exposure;
+            callback.specs.iso = (int)iso;
+            break;
+        }
+
         // set callback
         result = codec->SetCallback(&callback);
         if (result != S_OK) {
-            std::cout << "Failed to set IBlackmagicRawCallback!" << std::endl;
+            failure = "Failed to set IBlackmagicRawCallback!";
+            std::cout << failure << std::endl;
             break;
         }
 
         // create job
         result = clip->CreateJobReadFrame(0, &readJob);
         if (result != S_OK) {
-            std::cout << "Failed to create IBlackmagicRawJob!" << std::endl;
+            failure = "Failed to create IBlackmagicRawJob!";
+            std::cout << failure << std::endl;
             break;
         }
 
@@ -318,7 +446,8 @@ BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
         result = readJob->Submit();
         if (result != S_OK) {
             readJob->Release();
-            std::cout << "Failed to submit IBlackmagicRawJob!" << std::endl;
+            failure = "Failed to submit IBlackmagicRawJob!";
+            std::cout << failure << std::endl;
             break;
         }
         codec->FlushJobs();
@@ -339,13 +468,199 @@ BlackmagicRAWHandler::getClipSpecs(const std::string &filename,
 #ifdef _WIN32
     SysFreeString(cameraType);
 #endif
+    if (error != nullptr) { *error = failure; }
     return specs;
 }
 
 bool BlackmagicRAWHandler::hasFactory(const std::string &path)
 {
-    bool result = false;
-    if (path.empty()) { return result; }
+    IBlackmagicRawFactory* factory = acquireFactory(path);
+    if (factory == nullptr) { return false; }
+    factory->Release();
+    return true;
+}
+
+int BlackmagicRAWHandler::getAvailableCPUCount()
+{
+    int count = (int)std::thread::hardware_concurrency();
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        count = CPU_COUNT(&set);
+    }
+
+    // the quota of our cgroup or any of its parents, "max" when unlimited
+    std::string group;
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroup, line)) {
+        if (line.compare(0, 3, "0::") == 0) { group = line.substr(3); }
+    }
+    while (true) {
+        std::ifstream cpuMax(("/sys/fs/cgroup" + group + "/cpu.max").c_str());
+        std::string quota;
+        double period = 0;
+        if (cpuMax >> quota >> period && quota != "max" && period > 0) {
+            int quotaCount = (int)std::ceil(std::atof(quota.c_str()) / period);
+            count = std::min(count, std::max(1, quotaCount));
+        }
+        size_t parent = group.rfind('/');
+        if (group.empty() || parent == std::string::npos) { break; }
+        group = group.substr(0, parent);
+    }
+#endif
+    return std::max(1, count);
+}
+
+const std::string BlackmagicRAWHandler::getDefaultLibraryPath()
+{
+    std::string result;
+#ifdef _WIN32
+    char const* pfiles = getenv("ProgramFiles");
+    if (pfiles == nullptr) { return result; }
+    result = pfiles;
+    result.append("\\Adobe\\Common\\Plug-ins\\7.0\\MediaCore\\BlackmagicRawAPI");
+#elif __APPLE__
+    result = "/Applications/Blackmagic RAW/Blackmagic RAW SDK/Mac/Libraries";
+#else
+    result = "/usr/lib/blackmagic/BlackmagicRAWSDK/Linux/Libraries";
+    struct stat info;
+    if (stat(result.c_str(), &info) != 0 || !(info.st_mode & S_IFDIR)) {
+        result = "/usr/lib64/blackmagic/BlackmagicRAWSDK/Linux/Libraries";
+    }
+#endif
+    return result;
+}
+
+BlackmagicRAWHandler::FileIdentity
+BlackmagicRAWHandler::getFileIdentity(const std::string &filename)
+{
+    FileIdentity identity;
+    identity.filename = filename;
+    struct stat info;
+    if (!filename.empty() && stat(filename.c_str(), &info) == 0) {
+        identity.size = (long long)info.st_size;
+        identity.mtime = (long long)info.st_mtime;
+    }
+    std::string sidecar = getSidecarFilename(filename);
+    if (!sidecar.empty() && stat(sidecar.c_str(), &info) == 0) {
+        identity.sidecarSize = (long long)info.st_size;
+        identity.sidecarMtime = (long long)info.st_mtime;
+    }
+    return identity;
+}
+
+const std::string BlackmagicRAWHandler::getSidecarFilename(const std::string &filename)
+{
+    size_t dot = filename.find_last_of('.');
+    size_t separator = filename.find_last_of("/\\");
+    if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) { return std::string(); }
+    return filename.substr(0, dot) + ".sidecar";
+}
+
+const std::string BlackmagicRAWHandler::getCacheDir()
+{
+    std::string result;
+#ifdef _WIN32
+    char const* base = getenv("LOCALAPPDATA");
+    if (base == nullptr) { return result; }
+    result = base;
+    result.append("\\BlackmagicRAWOFX");
+    _mkdir(result.c_str());
+#else
+    char const* home = getenv("HOME");
+#ifdef __APPLE__
+    if (home == nullptr) { return result; }
+    result = home;
+    result.append("/Library/Caches");
+#else
+    char const* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg != nullptr && xdg[0] == '/') {
+        result = xdg;
+    } else if (home != nullptr) {
+        result = home;
+        result.append("/.cache");
+    } else {
+        return result;
+    }
+    mkdir(result.c_str(), 0700);
+#endif
+    result.append("/BlackmagicRAWOFX");
+    mkdir(result.c_str(), 0700);
+#endif
+    struct stat info;
+    if (stat(result.c_str(), &info) != 0 || !(info.st_mode & S_IFDIR)) { return std::string(); }
+    return result;
+}
+
+namespace {
+// FNV-1a
+inline void hashBytes(uint64_t &hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+template<typename T>
+inline void hashValue(uint64_t &hash, const T &value)
+{
+    hashBytes(hash, &value, sizeof(value));
+}
+inline void hashValue(uint64_t &hash, const std::string &value)
+{
+    hashBytes(hash, value.data(), value.size());
+    hashValue(hash, value.size());
+}
+}
+
+uint64_t BlackmagicRAWHandler::getProcessingHash(const BlackmagicRAWSpecs &specs)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hashValue(hash, specs.gamut);
+    hashValue(hash, specs.gamma);
+    hashValue(hash, specs.iso);
+    hashValue(hash, specs.recovery);
+    hashValue(hash, specs.colorTemp);
+    hashValue(hash, specs.tint);
+    hashValue(hash, specs.exposure);
+    hashValue(hash, specs.saturation);
+    hashValue(hash, specs.contrast);
+    hashValue(hash, specs.midpoint);
+    hashValue(hash, specs.highlights);
+    hashValue(hash, specs.shadows);
+    hashValue(hash, specs.videoBlackLevel);
+    return hash;
+}
+
+IBlackmagicRawFactory* BlackmagicRAWHandler::acquireFactory(const std::string &path)
+{
+    if (path.empty()) { return nullptr; }
+
+    // one factory per library path for the lifetime of the process, a failed
+    // lookup is cached as well so a missing SDK isn't probed on every call.
+    // never destroyed, the SDK library may already be gone at static destruction.
+    static std::mutex* factoryMutex = new std::mutex();
+    static std::map<std::string, IBlackmagicRawFactory*>* factories = new std::map<std::string, IBlackmagicRawFactory*>();
+
+    std::lock_guard<std::mutex> lock(*factoryMutex);
+    IBlackmagicRawFactory* factory = nullptr;
+    std::map<std::string, IBlackmagicRawFactory*>::const_iterator it = factories->find(path);
+    if (it != factories->end()) {
+        factory = it->second;
+    } else {
+        factory = createFactory(path);
+        (*factories)[path] = factory;
+    }
+    if (factory != nullptr) { factory->AddRef(); }
+    return factory;
+}
+
+IBlackmagicRawFactory* BlackmagicRAWHandler::createFactory(const std::string &path)
+{
+    if (path.empty()) { return nullptr; }
     IBlackmagicRawFactory* factory = nullptr;
 #ifdef _WIN32
     std::wstring wpath(path.begin(), path.end());
@@ -355,13 +670,31 @@ bool BlackmagicRAWHandler::hasFactory(const std::string &path)
 #elif __APPLE__
     CFStringRef cfpath = CFStringCreateWithCString(kCFAllocatorDefault, path.c_str(), kCFStringEncodingUTF8);
     factory = CreateBlackmagicRawFactoryInstanceFromPath(cfpath);
+    CFRelease(cfpath);
 #else
     factory = CreateBlackmagicRawFactoryInstanceFromPath(path.c_str());
 #endif
-    if (factory != nullptr) {
-        result = true;
-        factory->Release();
-    }
+    return factory;
+}
+
+HRESULT BlackmagicRAWHandler::openClip(IBlackmagicRaw *codec,
+                                       const std::string &filename,
+                                       IBlackmagicRawClip **clip)
+{
+    if (codec == nullptr || clip == nullptr || filename.empty()) { return E_INVALIDARG; }
+    HRESULT result = S_OK;
+#ifdef _WIN32
+    std::wstring wfile(filename.begin(), filename.end());
+    BSTR clipName = SysAllocStringLen(wfile.data(), wfile.size());
+    result = codec->OpenClip(clipName, clip);
+    SysFreeString(clipName);
+#elif __APPLE__
+    CFStringRef cffile = CFStringCreateWithCString(kCFAllocatorDefault, filename.c_str(), kCFStringEncodingUTF8);
+    result = codec->OpenClip(cffile, clip);
+    CFRelease(cffile);
+#else
+    result = codec->OpenClip(filename.c_str(), clip);
+#endif
     return result;
 }
 
@@ -403,21 +736,22 @@ void BlackmagickRAWSpecsCallback::ProcessComplete(IBlackmagicRawJob *job,
     if (job != nullptr) { job->Release(); }
 }
 
-void BlackmagickRAWRendererCallback::ReadComplete(IBlackmagicRawJob *readJob,
-                                                  HRESULT result,
-                                                  IBlackmagicRawFrame *frame)
+HRESULT BlackmagicRAWHandler::cloneProcessingAttributes(IBlackmagicRawClip *clip,
+                                                        IBlackmagicRawFrame *frame,
+                                                        const BlackmagicRAWSpecs &specs,
+                                                        IBlackmagicRawClipProcessingAttributes **clipAttrOut,
+                                                        IBlackmagicRawFrameProcessingAttributes **frameAttrOut)
 {
-    if (clip == nullptr) { return; }
-    IBlackmagicRawJob* decodeAndProcessJob = nullptr;
-    if (result == S_OK) {
-        VERIFY(frame->SetResourceFormat(s_resourceFormat));
-    }
+    if (clip == nullptr || frame == nullptr || clipAttrOut == nullptr || frameAttrOut == nullptr) { return E_INVALIDARG; }
+    HRESULT result = S_OK;
 
     // get and set attributes
     IBlackmagicRawFrameProcessingAttributes *frameAttr = nullptr;
     IBlackmagicRawClipProcessingAttributes *clipAttr = nullptr;
     result = frame->CloneFrameProcessingAttributes(&frameAttr);
-    result = clip->CloneClipProcessingAttributes(&clipAttr);
+    if (result == S_OK) {
+        result = clip->CloneClipProcessingAttributes(&clipAttr);
+    }
 
     if (result == S_OK) {
         BMVAR iso;
@@ -542,57 +876,130 @@ void BlackmagickRAWRendererCallback::ReadComplete(IBlackmagicRawJob *readJob,
                                             &videoBlackLevel);
     }
 
-    // set quality (scale)
-    switch (specs.quality) {
-    case BlackmagicRAWHandler::rawFullQuality:
+    if (result != S_OK) {
+        if (frameAttr != nullptr) { frameAttr->Release(); }
+        if (clipAttr != nullptr) { clipAttr->Release(); }
+        return result;
+    }
+    *clipAttrOut = clipAttr;
+    *frameAttrOut = frameAttr;
+    return S_OK;
+}
+
+HRESULT BlackmagicRAWHandler::setResolutionScale(IBlackmagicRawFrame *frame,
+                                                 int quality)
+{
+    if (frame == nullptr) { return E_INVALIDARG; }
+    HRESULT result = S_OK;
+    switch (quality) {
+    case rawFullQuality:
         result = frame->SetResolutionScale(blackmagicRawResolutionScaleFullUpsideDown);
         break;
-    case BlackmagicRAWHandler::rawHalfQuality:
+    case rawHalfQuality:
         result = frame->SetResolutionScale(blackmagicRawResolutionScaleHalfUpsideDown);
         break;
-    case BlackmagicRAWHandler::rawQuarterQuality:
+    case rawQuarterQuality:
         result = frame->SetResolutionScale(blackmagicRawResolutionScaleQuarterUpsideDown);
         break;
-    case BlackmagicRAWHandler::rawEighthQuality:
+    case rawEighthQuality:
         result = frame->SetResolutionScale(blackmagicRawResolutionScaleEighthUpsideDown);
         break;
     default:
         result = E_INVALIDARG;
     }
+    return result;
+}
 
-    // setup and run job
-    if (result == S_OK) {
-        result = frame->CreateJobDecodeAndProcessFrame(clipAttr,
-                                                       frameAttr,
-                                                       &decodeAndProcessJob);
+HRESULT BlackmagicRAWHandler::setInstructionSet(IBlackmagicRaw *codec,
+                                                int instructionSet)
+{
+    if (codec == nullptr) { return E_INVALIDARG; }
+    BlackmagicRawInstructionSet value;
+    switch (instructionSet) {
+    case rawInstructionSetSSE41:
+        value = blackmagicRawInstructionSetSSE41;
+        break;
+    case rawInstructionSetAVX:
+        value = blackmagicRawInstructionSetAVX;
+        break;
+    case rawInstructionSetAVX2:
+        value = blackmagicRawInstructionSetAVX2;
+        break;
+    default:
+        return S_OK;
     }
+    IBlackmagicRawConfigurationEx *configEx = nullptr;
+    HRESULT result = codec->QueryInterface(IID_IBlackmagicRawConfigurationEx, (void**)&configEx);
     if (result == S_OK) {
-        result = decodeAndProcessJob->Submit();
+        result = configEx->SetInstructionSet(value);
+        configEx->Release();
     }
-    if (result != S_OK) {
-        std::stringstream errorMsg;
-        errorMsg << "decodeAndProcessJob Error code = 0x" << std::hex << result << std::endl;
-        std::cout << errorMsg.str() << std::endl;
-        if (decodeAndProcessJob) {
-            decodeAndProcessJob->Release();
-        }
+    return result;
+}
+
+double BlackmagicRAWHandler::getQualityScale(int quality)
+{
+    switch (quality) {
+    case rawHalfQuality:
+        return 0.5;
+    case rawQuarterQuality:
+        return 0.25;
+    case rawEighthQuality:
+        return 0.125;
+    default:;
     }
+    return 1.;
+}
+
+int BlackmagicRAWHandler::getQualityForRenderScale(int quality,
+                                                   double renderScale)
+{
+    // never decode below the requested resolution, the rest is downscaled
+    double wanted = getQualityScale(quality) * std::min(renderScale, 1.);
+    int result = quality;
+    for (int next = quality + 1; next <= rawEighthQuality; ++next) {
+        if (getQualityScale(next) < wanted - 1e-6) { break; }
+        result = next;
+    }
+    return result;
+}
+
+void BlackmagickRAWRendererCallback::ReadComplete(IBlackmagicRawJob *readJob,
+                                                  HRESULT result,
+                                                  IBlackmagicRawFrame *frame)
+{
+    BlackmagickRAWRenderRequest *request = nullptr;
+    readJob->GetUserData((void**)&request);
     readJob->Release();
-    if (frameAttr != nullptr) { frameAttr->Release(); }
-    if (clipAttr != nullptr) { clipAttr->Release(); }
+    if (request != nullptr) {
+        request->readComplete(result, frame);
+    }
+}
+
+void BlackmagickRAWRendererCallback::DecodeComplete(IBlackmagicRawJob *job,
+                                                    HRESULT result)
+{
+    BlackmagickRAWRenderRequest *request = nullptr;
+    job->GetUserData((void**)&request);
+    job->Release();
+    if (request != nullptr) {
+        request->decodeComplete(result);
+    }
 }
 
 void BlackmagickRAWRendererCallback::ProcessComplete(IBlackmagicRawJob *job,
                                                      HRESULT result,
                                                      IBlackmagicRawProcessedImage *processedImage)
 {
-    if (result == S_OK) {
-        result = processedImage->GetResource(&frameBuffer);
-    } else {
+    BlackmagickRAWRenderRequest *request = nullptr;
+    job->GetUserData((void**)&request);
+    if (result != S_OK) {
         std::stringstream errorMsg;
         errorMsg << "ProcessComplete Error code = 0x" << std::hex << result << std::endl;
         std::cout << errorMsg.str() << std::endl;
     }
+    if (request != nullptr) {
+        request->processComplete(result, result == S_OK ? processedImage : nullptr);
+    }
     job->Release();
 }
-
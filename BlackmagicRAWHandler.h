@@ -21,6 +21,9 @@
 ###################################################################################
 */
 
+#ifndef BLACKMAGICRAWHANDLER_H
+#define BLACKMAGICRAWHANDLER_H
+
 #ifdef _WIN32
 #include "BlackmagicRawAPIDispatch.h"
 #else
@@ -50,6 +53,14 @@ public:
         rawQuarterQuality,
         rawEighthQuality
     };
+    enum BlackmagicRAWInstructionSet
+    {
+        rawInstructionSetAuto, // SDK default
+        rawInstructionSetBenchmark, // fastest measured on this machine
+        rawInstructionSetSSE41,
+        rawInstructionSetAVX,
+        rawInstructionSetAVX2
+    };
     struct BlackmagicRAWSpecs
     {
         int quality = rawFullQuality;
@@ -76,9 +87,66 @@ public:
         std::vector<std::string> availableGamma;
         std::vector<std::string> availableGamut;
     };
+    // the clip and its .sidecar, which holds the default ISO, white
+    // balance, exposure and so on. -1 when missing
+    struct FileIdentity
+    {
+        std::string filename;
+        long long size = -1;
+        long long mtime = -1;
+        long long sidecarSize = -1;
+        long long sidecarMtime = -1;
+        bool operator==(const FileIdentity &other) const
+        {
+            return filename == other.filename && size == other.size && mtime == other.mtime &&
+                   sidecarSize == other.sidecarSize && sidecarMtime == other.sidecarMtime;
+        }
+        bool operator!=(const FileIdentity &other) const { return !(*this == other); }
+    };
+    // clip specs, probed once per file identity and kept for the process
+    // lifetime. error is set to the first probe failure, if any
     static const BlackmagicRAWSpecs getClipSpecs(const std::string &filename,
-                                                 const std::string &path);
+                                                 const std::string &path,
+                                                 std::string *error = nullptr);
     static bool hasFactory(const std::string &path);
+    // CPUs this process may run on, bounded by the affinity mask and the
+    // cgroup v2 cpu.max quota on Linux
+    static int getAvailableCPUCount();
+    // SDK library location of a system wide install
+    static const std::string getDefaultLibraryPath();
+    static FileIdentity getFileIdentity(const std::string &filename);
+    // clip.sidecar next to clip.braw
+    static const std::string getSidecarFilename(const std::string &filename);
+    // per-user cache directory of the plugin (created on demand), empty if unavailable
+    static const std::string getCacheDir();
+    // hash of every spec field that affects frame processing (quality excluded)
+    static uint64_t getProcessingHash(const BlackmagicRAWSpecs &specs);
+    // process-wide factory for the given library path, must be released by the caller
+    static IBlackmagicRawFactory* acquireFactory(const std::string &path);
+    static HRESULT openClip(IBlackmagicRaw *codec,
+                            const std::string &filename,
+                            IBlackmagicRawClip **clip);
+    // clone the clip and frame processing attributes with the specs applied, caller releases both
+    static HRESULT cloneProcessingAttributes(IBlackmagicRawClip *clip,
+                                             IBlackmagicRawFrame *frame,
+                                             const BlackmagicRAWSpecs &specs,
+                                             IBlackmagicRawClipProcessingAttributes **clipAttr,
+                                             IBlackmagicRawFrameProcessingAttributes **frameAttr);
+    static HRESULT setResolutionScale(IBlackmagicRawFrame *frame,
+                                      int quality);
+    // force an SDK instruction set on the codec, auto and benchmark leave it alone
+    static HRESULT setInstructionSet(IBlackmagicRaw *codec,
+                                     int instructionSet);
+    // fraction of the full resolution decoded at the given quality
+    static double getQualityScale(int quality);
+    // lowest resolution quality that still covers quality at renderScale
+    static int getQualityForRenderScale(int quality,
+                                        double renderScale);
+private:
+    static IBlackmagicRawFactory* createFactory(const std::string &path);
+    static const BlackmagicRAWSpecs probeClipSpecs(const std::string &filename,
+                                                   const std::string &path,
+                                                   std::string *error);
 };
 
 class BlackmagickRAWSpecsCallback : public IBlackmagicRawCallback
@@ -130,21 +198,33 @@ public:
     virtual ULONG STDMETHODCALLTYPE Release(void) { return 0; }
 };
 
+// a single frame request, attached to its SDK jobs as user data
+class BlackmagickRAWRenderRequest
+{
+public:
+    virtual ~BlackmagickRAWRenderRequest() = default;
+    // frame and processedImage are only valid during the call
+    virtual void readComplete(HRESULT result,
+                              IBlackmagicRawFrame *frame) = 0;
+    virtual void decodeComplete(HRESULT result) = 0;
+    virtual void processComplete(HRESULT result,
+                                 IBlackmagicRawProcessedImage *processedImage) = 0;
+};
+
+// routes job completions to the BlackmagickRAWRenderRequest set as job user data
 class BlackmagickRAWRendererCallback : public IBlackmagicRawCallback
 {
 public:
     explicit BlackmagickRAWRendererCallback() = default;
     virtual ~BlackmagickRAWRendererCallback() = default;
-    IBlackmagicRawClip *clip = nullptr;
-    void *frameBuffer = nullptr;
-    BlackmagicRAWHandler::BlackmagicRAWSpecs specs;
     virtual void ReadComplete(IBlackmagicRawJob* readJob,
                               HRESULT result,
                               IBlackmagicRawFrame* frame);
     virtual void ProcessComplete(IBlackmagicRawJob* job,
                                  HRESULT result,
                                  IBlackmagicRawProcessedImage* processedImage);
-    virtual void DecodeComplete(IBlackmagicRawJob*, HRESULT) {}
+    virtual void DecodeComplete(IBlackmagicRawJob* job,
+                                HRESULT result);
     virtual void TrimProgress(IBlackmagicRawJob*, float) {}
     virtual void TrimComplete(IBlackmagicRawJob*, HRESULT) {}
 #ifdef _WIN32
@@ -180,3 +260,5 @@ public:
     virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 0; }
     virtual ULONG STDMETHODCALLTYPE Release(void) { return 0; }
 };
+
+#endif // BLACKMAGICRAWHANDLER_H
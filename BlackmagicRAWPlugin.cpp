@@ -22,12 +22,24 @@
 */
 
 #include "BlackmagicRAWHandler.h"
+#include "BlackmagicRAWSession.h"
+#include "BlackmagicRAWSessionPool.h"
+#include "BlackmagicRAWFrameCache.h"
+#include "BlackmagicRAWDiskCache.h"
+#include "BlackmagicRAWBufferPool.h"
+#include "BlackmagicRAWPrefetcher.h"
+#include "BlackmagicRAWProxyBuilder.h"
+#include "BlackmagicRAWScheduler.h"
+#include "BlackmagicRAWTransfer.h"
 #include "GenericReader.h"
 #include "GenericOCIO.h"
 #include "ofxsImageEffect.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 
 #define kPluginName "BlackmagicRAWOFX"
 #define kPluginGrouping "Image/Readers"
@@ -114,6 +126,71 @@
 #define kParamQualityHint "Decoding resolution"
 #define kParamQualityDefault BlackmagicRAWHandler::rawFullQuality
 
+#define kParamPerformance "performance"
+#define kParamPerformanceLabel "Performance"
+#define kParamPerformanceHint "Decoding and caching options"
+
+// settings of the caches and the scheduler are process-wide, each reader shows them
+#define kProcessWideHint " Process-wide: shared by all Blackmagic RAW readers, changing it on one changes it for all."
+
+#define kParamCacheSize "cacheSize"
+#define kParamCacheSizeLabel "Frame Cache (MB)"
+#define kParamCacheSizeHint "Memory budget for decoded frames, 0 disables the cache." kProcessWideHint
+#define kParamCacheSizeDefault 2048
+
+#define kParamCacheHalfFloat "cacheHalfFloat"
+#define kParamCacheHalfFloatLabel "Half Float Cache"
+#define kParamCacheHalfFloatHint "Keep cached frames as 16-bit half floats, the frame cache then holds twice as many frames. Cached frames lose precision (about 3 decimal digits, values above 65504 become infinite)." kProcessWideHint
+#define kParamCacheHalfFloatDefault false
+
+#define kParamCompressedCacheSize "compressedCacheSize"
+#define kParamCompressedCacheSizeLabel "Compressed Cache (MB)"
+#define kParamCompressedCacheSizeHint "Memory budget for frames evicted from the frame cache, kept losslessly compressed and decompressed when they are needed again. 0 drops evicted frames." kProcessWideHint
+#define kParamCompressedCacheSizeDefault 1024
+
+#define kParamDiskCacheDir "diskCacheDir"
+#define kParamDiskCacheDirLabel "Disk Cache Directory"
+#define kParamDiskCacheDirHint "Local directory (preferably on an SSD) where decoded frames are kept across sessions, frames found there are read back instead of decoded again. Empty disables the disk cache." kProcessWideHint
+#define kParamDiskCacheDirDefault ""
+
+#define kParamDiskCacheSize "diskCacheSize"
+#define kParamDiskCacheSizeLabel "Disk Cache (GB)"
+#define kParamDiskCacheSizeHint "Size limit of the disk cache directory, the least recently read frames are removed first." kProcessWideHint
+#define kParamDiskCacheSizeDefault 32
+
+#define kParamPrefetch "prefetch"
+#define kParamPrefetchLabel "Playback Read-Ahead"
+#define kParamPrefetchHint "Maximum number of frames to decode ahead. Frames are read ahead along the way they are requested (forward, reverse, every Nth frame or looping an in/out range), only as many as needed to keep up with the clip frame rate. Limited by the frame cache size."
+#define kParamPrefetchDefault 4
+
+#define kParamCPUThreads "cpuThreads"
+#define kParamCPUThreadsLabel "Decoder Threads"
+#define kParamCPUThreadsHint "CPU threads used by the SDK to decode this clip. 0 (auto) shares the CPUs available to the process (affinity and cgroup CPU quota) evenly between the Frames In Flight decoded at the same time."
+#define kParamCPUThreadsDefault 0
+
+#define kParamInstructionSet "instructionSet"
+#define kParamInstructionSetLabel "Instruction Set"
+#define kParamInstructionSetHint "CPU instruction set used by the SDK. Benchmark times each supported instruction set once per machine on the first clip opened and remembers the fastest."
+#define kParamInstructionSetDefault BlackmagicRAWHandler::rawInstructionSetAuto
+
+#define kParamDecodeLimit "decodeLimit"
+#define kParamDecodeLimitLabel "Frames In Flight"
+#define kParamDecodeLimitHint "Read-ahead frames decoded at the same time. Frames a render is waiting for always start right away and go ahead of queued read-ahead." kProcessWideHint
+#define kParamDecodeLimitDefault 4
+
+#define kParamMemoryStats "memoryStats"
+#define kParamMemoryStatsLabel "Memory Statistics"
+#define kParamMemoryStatsHint "Show frame cache and buffer pool usage."
+
+#define kParamProxyQuality "proxyQuality"
+#define kParamProxyQualityLabel "Proxy Resolution"
+#define kParamProxyQualityHint "Resolution of the proxies built with Build Proxies. They are used for renders at a matching render scale or quality, and for the resolutions below."
+#define kParamProxyQualityDefault 0
+
+#define kParamBuildProxies "buildProxies"
+#define kParamBuildProxiesLabel "Build Proxies"
+#define kParamBuildProxiesHint "Decode every frame of the clip at the proxy resolution into the disk cache, in the background and after any other render. Press again to see the progress, frames that failed are built again on the next press. Requires a disk cache directory."
+
 using namespace OFX;
 using namespace OFX::IO;
 
@@ -168,8 +245,23 @@ private:
                                        OfxRangeI &range) override final;
     static bool isDir(const std::string &path);
     static const std::string getLibraryPath();
-
-    BlackmagicRAWHandler::BlackmagicRAWSpecs _specs;
+    bool isProcessWideParam(const std::string &paramName) const;
+    // push the process-wide settings of our params to the caches and the scheduler
+    void applyProcessWideParams();
+    // show the current process-wide settings in our params
+    void syncProcessWideParams();
+    // processing settings and quality of the params
+    BlackmagicRAWHandler::BlackmagicRAWSpecs getProcessingSpecs();
+    // snapshot of the clip specs, safe to use from any render thread
+    std::shared_ptr<const BlackmagicRAWHandler::BlackmagicRAWSpecs> getSpecs() const;
+    void setSpecs(const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs);
+
+    mutable std::mutex _specsMutex;
+    std::shared_ptr<const BlackmagicRAWHandler::BlackmagicRAWSpecs> _specs; // replaced, never modified
+    BlackmagicRAWSession _session; // playback session, shared with the prefetcher
+    BlackmagicRAWPrefetcher _prefetcher;
+    BlackmagicRAWSessionPool _sessions; // other renders, one session per render thread
+    BlackmagicRAWProxyBuilder _proxies;
     ChoiceParam *_iso;
     ChoiceParam *_gamma;
     ChoiceParam *_gamut;
@@ -184,6 +276,16 @@ private:
     DoubleParam *_shadows;
     BooleanParam *_videoBlackLevel;
     ChoiceParam *_quality;
+    IntParam *_cacheSize;
+    BooleanParam *_cacheHalfFloat;
+    IntParam *_compressedCacheSize;
+    StringParam *_diskCacheDir;
+    IntParam *_diskCacheSize;
+    IntParam *_prefetch;
+    IntParam *_cpuThreads;
+    ChoiceParam *_instructionSet;
+    IntParam *_decodeLimit;
+    ChoiceParam *_proxyQuality;
 };
 
 BlackmagicRAWPlugin::BlackmagicRAWPlugin(OfxImageEffectHandle handle,
@@ -196,6 +298,8 @@ BlackmagicRAWPlugin::BlackmagicRAWPlugin(OfxImageEffectHandle handle,
                       false,
                       false,
                       false)
+, _specs(std::make_shared<const BlackmagicRAWHandler::BlackmagicRAWSpecs>())
+, _prefetcher(_session)
 , _iso(nullptr)
 , _gamma(nullptr)
 , _gamut(nullptr)
@@ -210,6 +314,16 @@ BlackmagicRAWPlugin::BlackmagicRAWPlugin(OfxImageEffectHandle handle,
 , _shadows(nullptr)
 , _videoBlackLevel(nullptr)
 , _quality(nullptr)
+, _cacheSize(nullptr)
+, _cacheHalfFloat(nullptr)
+, _compressedCacheSize(nullptr)
+, _diskCacheDir(nullptr)
+, _diskCacheSize(nullptr)
+, _prefetch(nullptr)
+, _cpuThreads(nullptr)
+, _instructionSet(nullptr)
+, _decodeLimit(nullptr)
+, _proxyQuality(nullptr)
 {
     _iso = fetchChoiceParam(kParamISO);
     _gamma = fetchChoiceParam(kParamGamma);
@@ -225,11 +339,42 @@ BlackmagicRAWPlugin::BlackmagicRAWPlugin(OfxImageEffectHandle handle,
     _shadows = fetchDoubleParam(kParamShadows);
     _videoBlackLevel = fetchBooleanParam(kParamVideoBlackLevel);
     _quality = fetchChoiceParam(kParamQuality);
+    _cacheSize = fetchIntParam(kParamCacheSize);
+    _cacheHalfFloat = fetchBooleanParam(kParamCacheHalfFloat);
+    _compressedCacheSize = fetchIntParam(kParamCompressedCacheSize);
+    _diskCacheDir = fetchStringParam(kParamDiskCacheDir);
+    _diskCacheSize = fetchIntParam(kParamDiskCacheSize);
+    _prefetch = fetchIntParam(kParamPrefetch);
+    _cpuThreads = fetchIntParam(kParamCPUThreads);
+    _instructionSet = fetchChoiceParam(kParamInstructionSet);
+    _decodeLimit = fetchIntParam(kParamDecodeLimit);
+    _proxyQuality = fetchChoiceParam(kParamProxyQuality);
 
     assert(_iso && _gamma && _gamma && _recovery && _colorTemp &&
            _tint && _exposure && _saturation && _contrast &&
            _midpoint && _highlights && _shadows && _videoBlackLevel &&
-           _quality);
+           _quality && _cacheSize && _cacheHalfFloat && _compressedCacheSize &&
+           _diskCacheDir && _diskCacheSize && _prefetch && _cpuThreads && _instructionSet && _decodeLimit && _proxyQuality);
+
+    // the first reader of the process sets the process-wide settings, the
+    // others show them instead of overriding them with their own. Hosts
+    // create instances on several threads, the others wait for the first.
+    // never destroyed, instances may outlive static destructors
+    static std::mutex* processWideMutex = new std::mutex();
+    static bool processWideApplied = false;
+    {
+        std::lock_guard<std::mutex> lock(*processWideMutex);
+        if (processWideApplied) {
+            syncProcessWideParams();
+        } else {
+            applyProcessWideParams();
+            processWideApplied = true;
+        }
+    }
+    _session.setCPUThreads(_cpuThreads->getValue());
+    _session.setInstructionSet(_instructionSet->getValue());
+    _sessions.setCPUThreads(_cpuThreads->getValue());
+    _sessions.setInstructionSet(_instructionSet->getValue());
 
 #ifdef _WIN32
     HRESULT result = S_OK;
@@ -248,31 +393,9 @@ BlackmagicRAWPlugin::~BlackmagicRAWPlugin()
 #endif
 }
 
-void
-BlackmagicRAWPlugin::decode(const std::string& filename,
-                            OfxTime time,
-                            int /*view*/,
-                            bool /*isPlayback*/,
-                            const OfxRectI& renderWindow,
-                            const OfxPointD& renderScale,
-                            float *pixelData,
-                            const OfxRectI& /*bounds*/,
-                            PixelComponentEnum pixelComponents,
-                            int pixelComponentCount,
-                            int /*rowBytes*/)
+BlackmagicRAWHandler::BlackmagicRAWSpecs
+BlackmagicRAWPlugin::getProcessingSpecs()
 {
-    assert(renderScale.x == 1. && renderScale.y == 1.);
-    unused(renderScale);
-    if (filename.empty() || pixelComponents != ePixelComponentRGB || pixelComponentCount != 3) {
-        setPersistentMessage(Message::eMessageError, "", "Wrong input!");
-        throwSuiteStatusException(kOfxStatErrFormat);
-    }
-
-    // get size
-    int width = renderWindow.x2 - renderWindow.x1;
-    int height= renderWindow.y2 - renderWindow.y1;
-
-    // set params
     BlackmagicRAWHandler::BlackmagicRAWSpecs specs;
     int iso_selected;
     std::string iso_string;
@@ -299,109 +422,159 @@ BlackmagicRAWPlugin::decode(const std::string& filename,
     _shadows->getValue(specs.shadows);
     _videoBlackLevel->getValue(specs.videoBlackLevel);
     _quality->getValue(specs.quality);
+    return specs;
+}
 
-    // setup and run job
-    HRESULT result = S_OK;
-    IBlackmagicRawFactory* factory = nullptr;
-    IBlackmagicRaw* codec = nullptr;
-    IBlackmagicRawClip* clip = nullptr;
-    IBlackmagicRawJob* readJob = nullptr;
-    BlackmagickRAWRendererCallback callback;
-    callback.specs = specs;
-    bool success = true;
-
-    do {
-#ifdef _WIN32
-        std::string libpath = getLibraryPath();
-        std::wstring wpath(libpath.begin(), libpath.end());
-        BSTR libraryPath = SysAllocStringLen(wpath.data(), wpath.size());
-        factory = CreateBlackmagicRawFactoryInstanceFromPath(libraryPath);
-        SysFreeString(libraryPath);
-#elif __APPLE__
-        CFStringRef cfpath = CFStringCreateWithCString(kCFAllocatorDefault, getLibraryPath().c_str(), kCFStringEncodingUTF8);
-        factory = CreateBlackmagicRawFactoryInstanceFromPath(cfpath);
-        //CFRelease(cfpath);
-#else
-        factory = CreateBlackmagicRawFactoryInstanceFromPath(getLibraryPath().c_str());
-#endif
-        if (factory == nullptr){
-            std::cout << "Failed to create IBlackmagicRawFactory!" << std::endl;
-            success = false;
-            break;
-        }
-        result = factory->CreateCodec(&codec);
-        if (result != S_OK) {
-            std::cout << "Failed to create IBlackmagicRaw!" << std::endl;
-            success = false;
-            break;
-        }
-#ifdef _WIN32
-        std::wstring wfile(filename.begin(), filename.end());
-        BSTR clipName = SysAllocStringLen(wfile.data(), wfile.size());
-        result = codec->OpenClip(clipName, &clip);
-        SysFreeString(clipName);
-#elif __APPLE__
-        CFStringRef cffile = CFStringCreateWithCString(kCFAllocatorDefault, filename.c_str(), kCFStringEncodingUTF8);
-        result = codec->OpenClip(cffile, &clip);
-        //CFRelease(cffile);
-#else
-        result = codec->OpenClip(filename.c_str(), &clip);
-#endif
-        if (result != S_OK) {
-            std::cout << "Failed to open IBlackmagicRawClip!" << std::endl;
-            success = false;
-            break;
-        }
-        callback.clip = clip;
-        result = codec->SetCallback(&callback);
-        if (result != S_OK) {
-            std::cout << "Failed to set IBlackmagicRawCallback!" << std::endl;
-            success = false;
-            break;
-        }
-        result = clip->CreateJobReadFrame(time>0?time-1:0, &readJob);
-        if (result != S_OK) {
-            std::cout << "Failed to create IBlackmagicRawJob!" << std::endl;
-            success = false;
-            break;
+void
+BlackmagicRAWPlugin::decode(const std::string& filename,
+                            OfxTime time,
+                            int /*view*/,
+                            bool isPlayback,
+                            const OfxRectI& renderWindow,
+                            const OfxPointD& renderScale,
+                            float *pixelData,
+                            const OfxRectI& bounds,
+                            PixelComponentEnum pixelComponents,
+                            int pixelComponentCount,
+                            int rowBytes)
+{
+    if (filename.empty() || pixelComponents != ePixelComponentRGB || pixelComponentCount != 3) {
+        setPersistentMessage(Message::eMessageError, "", "Wrong input!");
+        throwSuiteStatusException(kOfxStatErrFormat);
+    }
+
+    BlackmagicRAWHandler::BlackmagicRAWSpecs specs = getProcessingSpecs();
+
+    // decode at the lowest SDK resolution that covers the render scale
+    int fullQuality = specs.quality;
+    specs.quality = BlackmagicRAWHandler::getQualityForRenderScale(fullQuality,
+                                                                   std::max(renderScale.x, renderScale.y));
+
+    // get frame from cache or decode it on a persistent session
+    std::shared_ptr<const BlackmagicRAWHandler::BlackmagicRAWSpecs> clipSpecs = getSpecs();
+    BlackmagicRAWFrameCache::Key key;
+    key.file = BlackmagicRAWHandler::getFileIdentity(filename);
+    key.frame = time>0?time-1:0;
+    key.quality = specs.quality;
+    key.processingHash = BlackmagicRAWHandler::getProcessingHash(specs);
+    // outstanding SDK jobs are aborted as soon as the host gives up on the render
+    BlackmagicRAWSession::AbortCallback abortCallback = [this]() { return abort(); };
+    BlackmagicRAWFramePtr frame = _prefetcher.take(key, abortCallback);
+    if (frame) {
+        BlackmagicRAWFrameCache::instance().insert(key, frame);
+    } else {
+        frame = BlackmagicRAWFrameCache::instance().get(key);
+    }
+    // playback uses the prefetcher session, other renders check one out
+    BlackmagicRAWSessionPool::SessionPtr pooled;
+    BlackmagicRAWSession *session = &_session;
+    if (!frame && !isPlayback) {
+        pooled = _sessions.acquire(filename);
+        session = pooled.get();
+    }
+    // let the SDK process straight into the host buffer when it's a full,
+    // tightly packed image, unless the cache would keep an RGBF32 frame of
+    // its own: that one is decoded into our memory and copied to the host
+    // once, the same single copy. Without a cache, with a half float cache
+    // (it packs from the host buffer, a pass it makes anyway) or with a frame
+    // over the budget, no copy is made. Such a frame can't be shared with
+    // concurrent renders, but it can still use a decode someone else started
+    BlackmagicRAWFrameCache &cache = BlackmagicRAWFrameCache::instance();
+    size_t hostBytes = (size_t)rowBytes * (bounds.y2 - bounds.y1);
+    bool cacheCopies = hostBytes <= cache.budget() && !cache.halfFloat();
+    bool direct = !isPlayback && !cacheCopies &&
+                  renderScale.x == 1. && renderScale.y == 1. &&
+                  bounds.x1 == 0 && bounds.y1 == 0 &&
+                  renderWindow.x1 == bounds.x1 && renderWindow.y1 == bounds.y1 &&
+                  renderWindow.x2 == bounds.x2 && renderWindow.y2 == bounds.y2 &&
+                  rowBytes == (int)(bounds.x2 * 3 * sizeof(float));
+    if (!frame && direct) {
+        frame = BlackmagicRAWFrameCache::instance().waitInFlight(key, abortCallback);
+        if (!frame && !abort()) { frame = BlackmagicRAWDiskCache::instance().read(key); }
+        if (!frame && session->open(filename, getLibraryPath())) {
+            frame = session->decodeFrame(key, specs, (char*)pixelData, (size_t)rowBytes * bounds.y2, abortCallback);
+            // the host buffer is only lent to us, the cache keeps a copy
+            if (frame && frame->data() == pixelData) {
+                cache.insertCopy(key, frame);
+            } else if (frame) {
+                cache.insert(key, frame);
+            }
         }
-        result = readJob->Submit();
-        if (result != S_OK) {
-            readJob->Release();
-            std::cout << "Failed to submit IBlackmagicRawJob!" << std::endl;
-            success = false;
-            break;
+    } else if (!frame) {
+        // concurrent renders of the same frame share a single decode
+        frame = BlackmagicRAWFrameCache::instance().getOrDecode(key, [&]() {
+            BlackmagicRAWFramePtr decoded;
+            if (session->open(filename, getLibraryPath())) {
+                decoded = session->decodeFrame(key, specs, nullptr, 0, abortCallback);
+            }
+            return decoded;
+        }, abortCallback);
+    }
+    pooled.reset();
+
+    // nothing to report for an aborted render, read-ahead for it is dropped too
+    if (!frame && abort()) {
+        _prefetcher.cancel();
+        return;
+    }
+
+    // read ahead along the way frames are requested, other renders than
+    // playback decode on pooled sessions so ours may not be open yet
+    if (frame) {
+        _prefetcher.record((int64_t)key.frame);
+        if (!isPlayback && _prefetcher.hasPattern()) {
+            _session.open(filename, getLibraryPath());
         }
-        codec->FlushJobs();
-    } while(0);
+        _prefetcher.request(key, specs, frame->sizeBytes(), _prefetch->getValue(),
+                            clipSpecs->frameMax, clipSpecs->fps, isPlayback);
+    } else {
+        _prefetcher.cancel();
+    }
 
-    if (callback.frameBuffer == nullptr || !success) {
-        if (clip != nullptr) { clip->Release(); }
-        if (codec != nullptr) { codec->Release(); }
-        if (factory != nullptr) { factory->Release(); }
+    if (!frame) {
         std::string errorMsg = "Unable to render image. Note that some footage may not be supported at the moment.";
         setPersistentMessage(Message::eMessageError, "", errorMsg);
         throwSuiteStatusException(kOfxStatErrFormat);
         return;
     }
 
-    float* buffer = (float*)callback.frameBuffer;
-    int offset = 0;
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            pixelData[offset + 0] = buffer[offset + 0];
-            pixelData[offset + 1] = buffer[offset + 1];
-            pixelData[offset + 2] = buffer[offset + 2];
-            offset += pixelComponentCount;
-        }
+    if (frame->data() == pixelData) { return; } // processed in place
+
+    // copy the render window, rows are bottom-up in both buffers. The
+    // remaining scale between the decoded frame and the render scale
+    // (bounds at quality times renderScale) is done by downscaling
+    double scale = BlackmagicRAWHandler::getQualityScale(fullQuality);
+    double scaleX = (int)(clipSpecs->width * scale) * renderScale.x / frame->width();
+    double scaleY = (int)(clipSpecs->height * scale) * renderScale.y / frame->height();
+    BlackmagicRAWTransfer::Rect window;
+    window.x1 = renderWindow.x1;
+    window.y1 = renderWindow.y1;
+    window.x2 = renderWindow.x2;
+    window.y2 = renderWindow.y2;
+    BlackmagicRAWTransfer::Rect dstBounds;
+    dstBounds.x1 = bounds.x1;
+    dstBounds.y1 = bounds.y1;
+    dstBounds.x2 = bounds.x2;
+    dstBounds.y2 = bounds.y2;
+    if (std::abs(scaleX - 1.) < 1e-6 && std::abs(scaleY - 1.) < 1e-6) {
+        BlackmagicRAWTransfer::copyRGB(frame->data(),
+                                       frame->width(),
+                                       frame->height(),
+                                       window,
+                                       pixelData,
+                                       dstBounds,
+                                       rowBytes);
+    } else {
+        BlackmagicRAWTransfer::scaleRGB(frame->data(),
+                                        frame->width(),
+                                        frame->height(),
+                                        scaleX,
+                                        scaleY,
+                                        window,
+                                        pixelData,
+                                        dstBounds,
+                                        rowBytes);
     }
-
-    if (clip != nullptr) { clip->Release(); }
-    if (codec != nullptr) { codec->Release(); }
-    if (factory != nullptr) { factory->Release(); }
-    callback.frameBuffer = nullptr;
-    callback.clip = nullptr;
-    buffer = nullptr;
 }
 
 bool BlackmagicRAWPlugin::getFrameBounds(const std::string& /*filename*/,
@@ -414,27 +587,13 @@ bool BlackmagicRAWPlugin::getFrameBounds(const std::string& /*filename*/,
                                          int *tile_width,
                                          int *tile_height)
 {
-    int width = _specs.width;
-    int height = _specs.height;
-    if (width > 0 && height > 0) {
-        int quality;
-        _quality->getValue(quality);
-        switch (quality) {
-        case BlackmagicRAWHandler::rawHalfQuality:
-            width = (int)width/2;
-            height = (int)height/2;
-            break;
-        case BlackmagicRAWHandler::rawQuarterQuality:
-            width = (int)width/4;
-            height = (int)height/4;
-            break;
-        case BlackmagicRAWHandler::rawEighthQuality:
-            width = (int)width/8;
-            height = (int)height/8;
-            break;
-        default:;
-        }
-    }
+    // bounds at renderScale 1, decode() maps the render scale onto them
+    int quality;
+    _quality->getValue(quality);
+    double scale = BlackmagicRAWHandler::getQualityScale(quality);
+    std::shared_ptr<const BlackmagicRAWHandler::BlackmagicRAWSpecs> specs = getSpecs();
+    int width = (int)(specs->width * scale);
+    int height = (int)(specs->height * scale);
     if (width <= 0 || height <= 0) {
         return false;
     }
@@ -490,7 +649,7 @@ bool BlackmagicRAWPlugin::getFrameRate(const std::string &filename,
 {
     //std::cout << "getFrameRate " << filename << std::endl;
     assert(fps);
-    *fps = _specs.fps;
+    *fps = getSpecs()->fps;
     return true;
 }
 
@@ -502,10 +661,11 @@ bool BlackmagicRAWPlugin::getSequenceTimeDomain(const std::string &filename,
         if (!BlackmagicRAWHandler::hasFactory(getLibraryPath())) {
             setPersistentMessage(Message::eMessageMessage, "", "Blackmagic RAW SDK not found! Please install latest SDK from https://www.blackmagicdesign.com/support/.");
         }
-        _specs = BlackmagicRAWHandler::getClipSpecs(filename, getLibraryPath());
-        if (_specs.frameMax > 0) {
+        const BlackmagicRAWHandler::BlackmagicRAWSpecs specs = BlackmagicRAWHandler::getClipSpecs(filename, getLibraryPath());
+        setSpecs(specs);
+        if (specs.frameMax > 0) {
             range.min = 1;
-            range.max = _specs.frameMax;
+            range.max = specs.frameMax;
         }
     }
     return true;
@@ -518,31 +678,142 @@ bool BlackmagicRAWPlugin::isDir(const std::string &path)
     if (info.st_mode & S_IFDIR) { return true; }
     return false;
 }
+std::shared_ptr<const BlackmagicRAWHandler::BlackmagicRAWSpecs> BlackmagicRAWPlugin::getSpecs() const
+{
+    std::lock_guard<std::mutex> lock(_specsMutex);
+    return _specs;
+}
+
+void BlackmagicRAWPlugin::setSpecs(const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs)
+{
+    std::shared_ptr<const BlackmagicRAWHandler::BlackmagicRAWSpecs> snapshot = std::make_shared<const BlackmagicRAWHandler::BlackmagicRAWSpecs>(specs);
+    std::lock_guard<std::mutex> lock(_specsMutex);
+    _specs = snapshot;
+}
+
 const std::string BlackmagicRAWPlugin::getLibraryPath()
 {
-    std::string result;
     std::string bundle = ofxPath;
     bundle.append("/Contents/Resources/BlackmagicRAW");
     if (isDir(bundle)) { return bundle; }
-#ifdef _WIN32
-    char const* pfiles = getenv("ProgramFiles");
-    if (pfiles == nullptr) { return result; }
-    result = pfiles;
-    result.append("\\Adobe\\Common\\Plug-ins\\7.0\\MediaCore\\BlackmagicRawAPI");
-#elif __APPLE__
-    result = "/Applications/Blackmagic RAW/Blackmagic RAW SDK/Mac/Libraries";
-#else
-    result = "/usr/lib/blackmagic/BlackmagicRAWSDK/Linux/Libraries";
-    if (!isDir(result)) {
-        result = "/usr/lib64/blackmagic/BlackmagicRAWSDK/Linux/Libraries";
-    }
-#endif
-    return result;
+    return BlackmagicRAWHandler::getDefaultLibraryPath();
+}
+
+bool BlackmagicRAWPlugin::isProcessWideParam(const std::string &paramName) const
+{
+    return paramName == kParamCacheSize || paramName == kParamCacheHalfFloat ||
+           paramName == kParamCompressedCacheSize || paramName == kParamDiskCacheDir ||
+           paramName == kParamDiskCacheSize || paramName == kParamDecodeLimit;
+}
+
+void BlackmagicRAWPlugin::applyProcessWideParams()
+{
+    BlackmagicRAWFrameCache::instance().setBudget((size_t)std::max(0, _cacheSize->getValue()) << 20);
+    BlackmagicRAWFrameCache::instance().setHalfFloat(_cacheHalfFloat->getValue());
+    BlackmagicRAWFrameCache::instance().setCompressedBudget((size_t)std::max(0, _compressedCacheSize->getValue()) << 20);
+    BlackmagicRAWDiskCache::instance().setDirectory(_diskCacheDir->getValue());
+    BlackmagicRAWDiskCache::instance().setBudget((size_t)std::max(0, _diskCacheSize->getValue()) << 30);
+    BlackmagicRAWScheduler::instance().setLimit(_decodeLimit->getValue());
+}
+
+void BlackmagicRAWPlugin::syncProcessWideParams()
+{
+    // only what differs, so an unchanged project isn't marked as modified
+    int cacheSize = (int)(BlackmagicRAWFrameCache::instance().budget() >> 20);
+    if (_cacheSize->getValue() != cacheSize) { _cacheSize->setValue(cacheSize); }
+    bool halfFloat = BlackmagicRAWFrameCache::instance().halfFloat();
+    if (_cacheHalfFloat->getValue() != halfFloat) { _cacheHalfFloat->setValue(halfFloat); }
+    int compressedCacheSize = (int)(BlackmagicRAWFrameCache::instance().compressedBudget() >> 20);
+    if (_compressedCacheSize->getValue() != compressedCacheSize) { _compressedCacheSize->setValue(compressedCacheSize); }
+    std::string diskCacheDir = BlackmagicRAWDiskCache::instance().directory();
+    if (_diskCacheDir->getValue() != diskCacheDir) { _diskCacheDir->setValue(diskCacheDir); }
+    int diskCacheSize = (int)(BlackmagicRAWDiskCache::instance().budget() >> 30);
+    if (_diskCacheSize->getValue() != diskCacheSize) { _diskCacheSize->setValue(diskCacheSize); }
+    int decodeLimit = BlackmagicRAWScheduler::instance().limit();
+    if (_decodeLimit->getValue() != decodeLimit) { _decodeLimit->setValue(decodeLimit); }
 }
 
 void BlackmagicRAWPlugin::changedParam(const InstanceChangedArgs &args,
                                        const std::string &paramName)
 {
+    // edits by syncProcessWideParams() only show the current settings, any
+    // other change is a chance to catch up with edits on other readers
+    if (isProcessWideParam(paramName)) {
+        if (args.reason == eChangePluginEdit) { return; }
+    } else {
+        syncProcessWideParams();
+    }
+
+    if (paramName == kParamCacheSize) {
+        BlackmagicRAWFrameCache::instance().setBudget((size_t)std::max(0, _cacheSize->getValue()) << 20);
+        return;
+    } else if (paramName == kParamCacheHalfFloat) {
+        BlackmagicRAWFrameCache::instance().setHalfFloat(_cacheHalfFloat->getValue());
+        return;
+    } else if (paramName == kParamCompressedCacheSize) {
+        BlackmagicRAWFrameCache::instance().setCompressedBudget((size_t)std::max(0, _compressedCacheSize->getValue()) << 20);
+        return;
+    } else if (paramName == kParamDiskCacheDir) {
+        BlackmagicRAWDiskCache::instance().setDirectory(_diskCacheDir->getValue());
+        return;
+    } else if (paramName == kParamDiskCacheSize) {
+        BlackmagicRAWDiskCache::instance().setBudget((size_t)std::max(0, _diskCacheSize->getValue()) << 30);
+        return;
+    } else if (paramName == kParamPrefetch) {
+        if (_prefetch->getValue() == 0) { _prefetcher.cancel(); }
+        return;
+    } else if (paramName == kParamCPUThreads) {
+        _prefetcher.cancel();
+        _session.setCPUThreads(_cpuThreads->getValue());
+        _sessions.setCPUThreads(_cpuThreads->getValue());
+        return;
+    } else if (paramName == kParamInstructionSet) {
+        _prefetcher.cancel();
+        _session.setInstructionSet(_instructionSet->getValue());
+        _sessions.setInstructionSet(_instructionSet->getValue());
+        return;
+    } else if (paramName == kParamDecodeLimit) {
+        BlackmagicRAWScheduler::instance().setLimit(_decodeLimit->getValue());
+        return;
+    } else if (paramName == kParamMemoryStats) {
+        BlackmagicRAWBufferPool::Stats pool = BlackmagicRAWBufferPool::instance().stats();
+        std::ostringstream stats;
+        stats << "Frame cache: " << (BlackmagicRAWFrameCache::instance().sizeBytes() >> 20) << " MB" << std::endl;
+        stats << "Compressed cache: " << (BlackmagicRAWFrameCache::instance().compressedSizeBytes() >> 20) << " MB" << std::endl;
+        stats << "Disk cache: " << (BlackmagicRAWDiskCache::instance().sizeBytes() >> 20) << " MB" << std::endl;
+        stats << "Buffer pool: " << (pool.usedBytes >> 20) << " MB in use, ";
+        stats << (pool.pooledBytes >> 20) << " MB free" << std::endl;
+        stats << "Buffer pool hits: " << pool.hits << ", misses: " << pool.misses;
+        sendMessage(Message::eMessageMessage, "", stats.str());
+        return;
+    } else if (paramName == kParamBuildProxies) {
+        std::string filename;
+        _fileParam->getValue(filename);
+        if (filename.empty()) { return; }
+        BlackmagicRAWProxyBuilder::Progress progress = _proxies.progress();
+        if (progress.running && progress.filename == filename) {
+            std::ostringstream message;
+            message << "Building proxies: " << progress.done << " of " << progress.total << " frames";
+            if (progress.failed > 0) { message << ", " << progress.failed << " failed"; }
+            sendMessage(Message::eMessageMessage, "", message.str());
+            return;
+        }
+        if (BlackmagicRAWDiskCache::instance().directory().empty()) {
+            sendMessage(Message::eMessageError, "", "Proxies are kept in the disk cache, set a Disk Cache Directory first.");
+            return;
+        }
+        int quality = BlackmagicRAWHandler::rawQuarterQuality + _proxyQuality->getValue();
+        _proxies.start(filename, getLibraryPath(), getProcessingSpecs(), quality);
+        if (progress.filename == filename && progress.quality == quality && progress.failed > 0) {
+            // frames already on disk are skipped, only the failed ones are built again
+            std::ostringstream message;
+            message << progress.failed << " of " << progress.total << " proxy frames failed in the last build, building them again in the background.";
+            sendMessage(Message::eMessageWarning, "", message.str());
+            return;
+        }
+        sendMessage(Message::eMessageMessage, "", "Building proxies in the background.");
+        return;
+    }
     GenericReaderPlugin::changedParam(args, paramName);
 }
 
@@ -551,13 +822,14 @@ void BlackmagicRAWPlugin::restoreStateFromParams()
     std::string filename;
     _fileParam->getValue(filename);
     if (!filename.empty()) {
-        _specs = BlackmagicRAWHandler::getClipSpecs(filename, getLibraryPath());
-
-        _iso->resetOptions(_specs.availableISO);
-        if (_specs.iso > 0) {
-            for (uint32_t i = 0; i < _specs.availableISO.size(); ++i) {
-                int currentISO = std::stoi(_specs.availableISO.at(i));
-                if ( currentISO == _specs.iso) {
+        const BlackmagicRAWHandler::BlackmagicRAWSpecs specs = BlackmagicRAWHandler::getClipSpecs(filename, getLibraryPath());
+        setSpecs(specs);
+
+        _iso->resetOptions(specs.availableISO);
+        if (specs.iso > 0) {
+            for (uint32_t i = 0; i < specs.availableISO.size(); ++i) {
+                int currentISO = std::stoi(specs.availableISO.at(i));
+                if ( currentISO == specs.iso) {
                     _iso->setDefault(i);
                     _iso->resetToDefault();
                     break;
@@ -565,10 +837,10 @@ void BlackmagicRAWPlugin::restoreStateFromParams()
             }
         }
 
-        _gamma->resetOptions(_specs.availableGamma);
-        if (!_specs.gamma.empty()) {
-            for (uint32_t i = 0; i < _specs.availableGamma.size(); ++i) {
-                if (_specs.availableGamma.at(i) == _specs.gamma) {
+        _gamma->resetOptions(specs.availableGamma);
+        if (!specs.gamma.empty()) {
+            for (uint32_t i = 0; i < specs.availableGamma.size(); ++i) {
+                if (specs.availableGamma.at(i) == specs.gamma) {
                     _gamma->setDefault(i);
                     _gamma->resetToDefault();
                     break;
@@ -576,10 +848,10 @@ void BlackmagicRAWPlugin::restoreStateFromParams()
             }
         }
 
-        _gamut->resetOptions(_specs.availableGamut);
-        if (!_specs.gamut.empty()) {
-            for (uint32_t i = 0; i < _specs.availableGamut.size(); ++i) {
-                if (_specs.availableGamut.at(i) == _specs.gamut) {
+        _gamut->resetOptions(specs.availableGamut);
+        if (!specs.gamut.empty()) {
+            for (uint32_t i = 0; i < specs.availableGamut.size(); ++i) {
+                if (specs.availableGamut.at(i) == specs.gamut) {
                     _gamut->setDefault(i);
                     _gamut->resetToDefault();
                     break;
@@ -587,32 +859,32 @@ void BlackmagicRAWPlugin::restoreStateFromParams()
             }
         }
 
-        _colorTemp->setDefault(_specs.colorTemp);
-        _colorTemp->setValue(_specs.colorTemp);
+        _colorTemp->setDefault(specs.colorTemp);
+        _colorTemp->setValue(specs.colorTemp);
 
-        _tint->setDefault(_specs.tint);
-        _tint->setValue(_specs.tint);
+        _tint->setDefault(specs.tint);
+        _tint->setValue(specs.tint);
 
-        _exposure->setDefault(_specs.exposure);
-        _exposure->setValue(_specs.exposure);
+        _exposure->setDefault(specs.exposure);
+        _exposure->setValue(specs.exposure);
 
-        _saturation->setDefault(_specs.saturation);
-        _saturation->setValue(_specs.saturation);
+        _saturation->setDefault(specs.saturation);
+        _saturation->setValue(specs.saturation);
 
-        _contrast->setDefault(_specs.contrast);
-        _contrast->setValue(_specs.contrast);
+        _contrast->setDefault(specs.contrast);
+        _contrast->setValue(specs.contrast);
 
-        _midpoint->setDefault(_specs.midpoint);
-        _midpoint->setValue(_specs.midpoint);
+        _midpoint->setDefault(specs.midpoint);
+        _midpoint->setValue(specs.midpoint);
 
-        _highlights->setDefault(_specs.highlights);
-        _highlights->setValue(_specs.highlights);
+        _highlights->setDefault(specs.highlights);
+        _highlights->setValue(specs.highlights);
 
-        _shadows->setDefault(_specs.shadows);
-        _shadows->setValue(_specs.shadows);
+        _shadows->setDefault(specs.shadows);
+        _shadows->setValue(specs.shadows);
 
-        _videoBlackLevel->setDefault(_specs.videoBlackLevel);
-        _videoBlackLevel->setValue(_specs.videoBlackLevel);
+        _videoBlackLevel->setDefault(specs.videoBlackLevel);
+        _videoBlackLevel->setValue(specs.videoBlackLevel);
     }
     GenericReaderPlugin::restoreStateFromParams();
 }
@@ -634,6 +906,10 @@ void BlackmagicRAWPluginFactory::describe(ImageEffectDescriptor &desc)
                           false);
     desc.setLabel(kPluginName);
     desc.setPluginDescription(kPluginDescription);
+    // decode() maps the render scale onto the SDK resolution scales
+    desc.setSupportsMultiResolution(true);
+    // renders only share thread-safe state, see decode()
+    desc.setRenderThreadSafety(eRenderFullySafe);
 }
 
 void BlackmagicRAWPluginFactory::describeInContext(ImageEffectDescriptor &desc,
@@ -763,6 +1039,148 @@ void BlackmagicRAWPluginFactory::describeInContext(ImageEffectDescriptor &desc,
         if (group) { param->setParent(*group); }
         if (page) { page->addChild(*param); }
     }
+    GroupParamDescriptor* performance = desc.defineGroupParam(kParamPerformance);
+    if (performance) {
+        performance->setLabel(kParamPerformanceLabel);
+        performance->setHint(kParamPerformanceHint);
+        performance->setLayoutHint(eLayoutHintDivider);
+        performance->setOpen(false);
+    }
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamCacheSize);
+        param->setLabel(kParamCacheSizeLabel);
+        param->setHint(kParamCacheSizeHint);
+        param->setRange(0, 1024 * 1024);
+        param->setDisplayRange(0, 65536);
+        param->setDefault(kParamCacheSizeDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamCacheHalfFloat);
+        param->setLabel(kParamCacheHalfFloatLabel);
+        param->setHint(kParamCacheHalfFloatHint);
+        param->setDefault(kParamCacheHalfFloatDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamCompressedCacheSize);
+        param->setLabel(kParamCompressedCacheSizeLabel);
+        param->setHint(kParamCompressedCacheSizeHint);
+        param->setRange(0, 1024 * 1024);
+        param->setDisplayRange(0, 65536);
+        param->setDefault(kParamCompressedCacheSizeDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        StringParamDescriptor *param = desc.defineStringParam(kParamDiskCacheDir);
+        param->setLabel(kParamDiskCacheDirLabel);
+        param->setHint(kParamDiskCacheDirHint);
+        param->setStringType(eStringTypeDirectoryPath);
+        param->setFilePathExists(false);
+        param->setDefault(kParamDiskCacheDirDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamDiskCacheSize);
+        param->setLabel(kParamDiskCacheSizeLabel);
+        param->setHint(kParamDiskCacheSizeHint);
+        param->setRange(0, 64 * 1024);
+        param->setDisplayRange(0, 1024);
+        param->setDefault(kParamDiskCacheSizeDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamPrefetch);
+        param->setLabel(kParamPrefetchLabel);
+        param->setHint(kParamPrefetchHint);
+        param->setRange(0, 64);
+        param->setDisplayRange(0, 16);
+        param->setDefault(kParamPrefetchDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamCPUThreads);
+        param->setLabel(kParamCPUThreadsLabel);
+        param->setHint(kParamCPUThreadsHint);
+        param->setRange(0, 256);
+        param->setDisplayRange(0, 64);
+        param->setDefault(kParamCPUThreadsDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamInstructionSet);
+        param->setLabel(kParamInstructionSetLabel);
+        param->setHint(kParamInstructionSetHint);
+        param->appendOption("Auto");
+        param->appendOption("Benchmark");
+        param->appendOption("SSE 4.1");
+        param->appendOption("AVX");
+        param->appendOption("AVX2");
+        param->setDefault(kParamInstructionSetDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamDecodeLimit);
+        param->setLabel(kParamDecodeLimitLabel);
+        param->setHint(kParamDecodeLimitHint);
+        param->setRange(1, 64);
+        param->setDisplayRange(1, 16);
+        param->setDefault(kParamDecodeLimitDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        PushButtonParamDescriptor *param = desc.definePushButtonParam(kParamMemoryStats);
+        param->setLabel(kParamMemoryStatsLabel);
+        param->setHint(kParamMemoryStatsHint);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamProxyQuality);
+        param->setLabel(kParamProxyQualityLabel);
+        param->setHint(kParamProxyQualityHint);
+        param->appendOption("Quarter");
+        param->appendOption("Eighth");
+        param->setDefault(kParamProxyQualityDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
+    {
+        PushButtonParamDescriptor *param = desc.definePushButtonParam(kParamBuildProxies);
+        param->setLabel(kParamBuildProxiesLabel);
+        param->setHint(kParamBuildProxiesHint);
+        if (performance) { param->setParent(*performance); }
+        if (page) { page->addChild(*param); }
+    }
     GenericReaderDescribeInContextEnd(desc,
                                       context,
                                       page,
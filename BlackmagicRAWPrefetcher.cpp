@@ -0,0 +1,169 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWPrefetcher.h"
+#include "BlackmagicRAWDiskCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+// frames in flight on top of what the measured decode time needs
+#define kPrefetchDepthMargin 1
+// weight of a new sample in the running decode time average
+#define kDecodeTimeWeight 0.2
+
+namespace {
+bool sameState(const BlackmagicRAWFrameCache::Key &a,
+               const BlackmagicRAWFrameCache::Key &b)
+{
+    return a.file == b.file && a.quality == b.quality && a.processingHash == b.processingHash;
+}
+}
+
+BlackmagicRAWPrefetcher::BlackmagicRAWPrefetcher(BlackmagicRAWSession &session)
+: _session(session)
+, _decodeSeconds(0.)
+{
+}
+
+BlackmagicRAWPrefetcher::~BlackmagicRAWPrefetcher()
+{
+    // nobody will pick up the frames still in flight
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (EntryMap::iterator it = _queue.begin(); it != _queue.end(); ++it) {
+        it->second.job.abort();
+    }
+    _queue.clear();
+}
+
+void BlackmagicRAWPrefetcher::record(int64_t frame)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pattern.record(frame);
+}
+
+bool BlackmagicRAWPrefetcher::hasPattern()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pattern.kind() != BlackmagicRAWAccessPattern::patternNone;
+}
+
+void BlackmagicRAWPrefetcher::request(const BlackmagicRAWFrameCache::Key &key,
+                                      const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                      size_t frameBytes,
+                                      int depth,
+                                      int frameCount,
+                                      double fps,
+                                      bool isPlayback)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // enough frames in flight to cover one decode at the clip frame rate,
+    // never more than asked for or than the frame cache budget can hold
+    if (_decodeSeconds > 0. && fps > 0.) {
+        depth = std::min(depth, (int)std::ceil(_decodeSeconds * fps) + kPrefetchDepthMargin);
+    }
+    size_t maxDepth = std::max((size_t)1, BlackmagicRAWFrameCache::instance().budget() / std::max(frameBytes, (size_t)1));
+    depth = (int)std::min((size_t)std::max(depth, 0), maxDepth);
+
+    // during playback read ahead even before a pattern shows, other
+    // renders only prefetch along a pattern and as background work
+    std::vector<int64_t> frames = _pattern.predict(depth, frameCount, isPlayback);
+    BlackmagicRAWScheduler::Priority priority = isPlayback ? BlackmagicRAWScheduler::priorityPlayback
+                                                           : BlackmagicRAWScheduler::priorityBackground;
+
+    // frames off the predicted path, or decoded with other settings, go to the frame cache
+    EntryMap::iterator it = _queue.begin();
+    while (it != _queue.end()) {
+        if (!sameState(it->second.key, key) ||
+            std::find(frames.begin(), frames.end(), (int64_t)it->first) == frames.end()) {
+            EntryMap::iterator next = it;
+            ++next;
+            flushLocked(it);
+            it = next;
+        } else {
+            ++it;
+        }
+    }
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (_queue.count((uint64_t)frames[i])) { continue; }
+        Entry entry;
+        entry.key = key;
+        entry.key.frame = (uint64_t)frames[i];
+        // frames on disk are read back faster than they decode
+        if (BlackmagicRAWFrameCache::instance().contains(entry.key) ||
+            BlackmagicRAWDiskCache::instance().contains(entry.key)) {
+            continue;
+        }
+        entry.job = _session.submitFrame(entry.key, specs, priority);
+        _queue[entry.key.frame] = entry;
+    }
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWPrefetcher::take(const BlackmagicRAWFrameCache::Key &key,
+                                                    const BlackmagicRAWSession::AbortCallback &abortCallback)
+{
+    BlackmagicRAWSession::Job job;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        EntryMap::iterator it = _queue.find(key.frame);
+        if (it == _queue.end() || !(it->second.key == key)) { return BlackmagicRAWFramePtr(); }
+        job = it->second.job;
+        _queue.erase(it);
+    }
+    // the frame is already in flight, waiting is cheaper than decoding it twice
+    BlackmagicRAWFramePtr frame = job.wait(abortCallback);
+    if (frame) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        sampleLocked(job.decodeSeconds());
+    }
+    return frame;
+}
+
+void BlackmagicRAWPrefetcher::cancel()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pattern.reset();
+    while (!_queue.empty()) {
+        flushLocked(_queue.begin());
+    }
+}
+
+void BlackmagicRAWPrefetcher::flushLocked(EntryMap::iterator it)
+{
+    // finished frames are kept, unfinished ones are dropped
+    if (it->second.job.isReady()) {
+        BlackmagicRAWFrameCache::instance().insert(it->second.key, it->second.job.frame.get());
+        sampleLocked(it->second.job.decodeSeconds());
+    } else {
+        it->second.job.abort();
+    }
+    _queue.erase(it);
+}
+
+void BlackmagicRAWPrefetcher::sampleLocked(double seconds)
+{
+    if (seconds <= 0.) { return; }
+    _decodeSeconds = _decodeSeconds > 0. ? _decodeSeconds + (seconds - _decodeSeconds) * kDecodeTimeWeight : seconds;
+}
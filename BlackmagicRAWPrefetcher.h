@@ -0,0 +1,89 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWPREFETCHER_H
+#define BLACKMAGICRAWPREFETCHER_H
+
+#include "BlackmagicRAWAccessPattern.h"
+#include "BlackmagicRAWSession.h"
+
+#include <map>
+
+/*
+ * Read-ahead for a plugin instance.
+ *
+ * Every requested frame feeds a BlackmagicRAWAccessPattern, the frames it
+ * predicts (forward, reverse, every Nth or around a loop) are submitted to
+ * the instance session, which keeps them all in flight on its codec.
+ * Submitted frames form a ready-queue that decode() picks up. The queue is
+ * only as deep as needed to cover the measured decode time at the clip
+ * frame rate, and never holds more than the frame cache budget.
+ */
+class BlackmagicRAWPrefetcher
+{
+public:
+    explicit BlackmagicRAWPrefetcher(BlackmagicRAWSession &session);
+    ~BlackmagicRAWPrefetcher();
+
+    // add a rendered frame to the access pattern
+    void record(int64_t frame);
+    // true once frames are requested along a known pattern
+    bool hasPattern();
+    // schedule read-ahead along the pattern from the last recorded frame, at
+    // most depth frames. Playback reads ahead before a pattern is known
+    void request(const BlackmagicRAWFrameCache::Key &key,
+                 const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                 size_t frameBytes,
+                 int depth,
+                 int frameCount,
+                 double fps,
+                 bool isPlayback);
+    // get a prefetched frame, waits if it's still in flight (until
+    // abortCallback returns true) and removes it from the queue
+    BlackmagicRAWFramePtr take(const BlackmagicRAWFrameCache::Key &key,
+                               const BlackmagicRAWSession::AbortCallback &abortCallback = BlackmagicRAWSession::AbortCallback());
+    // drop pending work and forget the pattern, finished frames are handed
+    // to the frame cache and unfinished ones are aborted
+    void cancel();
+
+private:
+    struct Entry
+    {
+        BlackmagicRAWFrameCache::Key key;
+        BlackmagicRAWSession::Job job;
+    };
+    typedef std::map<uint64_t, Entry> EntryMap;
+
+    BlackmagicRAWPrefetcher(const BlackmagicRAWPrefetcher&) = delete;
+    BlackmagicRAWPrefetcher& operator=(const BlackmagicRAWPrefetcher&) = delete;
+    void flushLocked(EntryMap::iterator it);
+    void sampleLocked(double seconds);
+
+    BlackmagicRAWSession &_session;
+    std::mutex _mutex;
+    EntryMap _queue;
+    BlackmagicRAWAccessPattern _pattern;
+    double _decodeSeconds; // running average of a frame on the codec
+};
+
+#endif // BLACKMAGICRAWPREFETCHER_H
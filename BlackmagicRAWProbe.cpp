@@ -0,0 +1,96 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+// braw-probe: probe Blackmagic RAW clips in parallel and print their specs
+
+#include "BlackmagicRAWBatchProbe.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace {
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-j threads] [-l library path] file|directory ..." << std::endl;
+}
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 0;
+    std::string path = BlackmagicRAWHandler::getDefaultLibraryPath();
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else {
+            struct stat info;
+            if (stat(argv[i], &info) == 0 && (info.st_mode & S_IFDIR)) {
+                std::vector<std::string> clips = BlackmagicRAWBatchProbe::listClips(argv[i]);
+                files.insert(files.end(), clips.begin(), clips.end());
+            } else {
+                files.push_back(argv[i]);
+            }
+        }
+    }
+    if (files.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+#ifdef _WIN32
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<BlackmagicRAWBatchProbe::Result> results = BlackmagicRAWBatchProbe::probe(files, path, threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BlackmagicRAWBatchProbe::Result &result = results[i];
+        if (!result.error.empty()) {
+            std::cout << result.filename << ": " << result.error << std::endl;
+            failed++;
+            continue;
+        }
+        const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs = result.specs;
+        std::cout << result.filename << ": " << specs.width << "x" << specs.height;
+        std::cout << " " << specs.fps << " fps, " << specs.frameMax << " frames";
+        std::cout << ", ISO " << specs.iso << ", " << specs.colorTemp << "K";
+        std::cout << ", " << specs.gamut << " / " << specs.gamma << std::endl;
+    }
+    std::cout << results.size() - failed << " of " << results.size() << " clips probed in " << seconds << " s" << std::endl;
+#ifdef _WIN32
+    CoUninitialize();
+#endif
+    return failed > 0 ? 1 : 0;
+}
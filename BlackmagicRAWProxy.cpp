@@ -0,0 +1,123 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+// braw-proxy: build quarter or eighth resolution proxies of Blackmagic RAW
+// clips into the disk cache of the plugin
+
+#include "BlackmagicRAWBatchProbe.h"
+#include "BlackmagicRAWDiskCache.h"
+#include "BlackmagicRAWProxyBuilder.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace {
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " -d cache directory [-q quarter|eighth] [-s size GB] [-l library path] file|directory ..." << std::endl;
+    std::cout << "The cache directory is the Disk Cache Directory of the Read node, clips are" << std::endl;
+    std::cout << "processed with their own metadata settings" << std::endl;
+}
+}
+
+int main(int argc, char **argv)
+{
+    std::string directory;
+    int quality = BlackmagicRAWHandler::rawQuarterQuality;
+    int sizeGB = -1;
+    std::string path = BlackmagicRAWHandler::getDefaultLibraryPath();
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            directory = argv[++i];
+        } else if (std::strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "quarter") == 0) {
+                quality = BlackmagicRAWHandler::rawQuarterQuality;
+            } else if (std::strcmp(argv[i], "eighth") == 0) {
+                quality = BlackmagicRAWHandler::rawEighthQuality;
+            } else {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            sizeGB = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else {
+            struct stat info;
+            if (stat(argv[i], &info) == 0 && (info.st_mode & S_IFDIR)) {
+                std::vector<std::string> clips = BlackmagicRAWBatchProbe::listClips(argv[i]);
+                files.insert(files.end(), clips.begin(), clips.end());
+            } else {
+                files.push_back(argv[i]);
+            }
+        }
+    }
+    if (files.empty() || directory.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+#ifdef _WIN32
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+    BlackmagicRAWDiskCache::instance().setDirectory(directory);
+    if (sizeGB >= 0) { BlackmagicRAWDiskCache::instance().setBudget((size_t)sizeGB << 30); }
+
+    int failed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        BlackmagicRAWHandler::BlackmagicRAWSpecs specs = BlackmagicRAWHandler::getClipSpecs(files[i], path);
+        BlackmagicRAWProxyBuilder::Progress result;
+        bool built = BlackmagicRAWProxyBuilder::build(files[i], path, specs, quality, BlackmagicRAWProxyBuilder::AbortCallback(),
+                                                      [&](const BlackmagicRAWProxyBuilder::Progress &progress) {
+            result = progress;
+        });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!built) {
+            std::cout << files[i] << ": failed" << std::endl;
+            failed++;
+            continue;
+        }
+        if (result.failed > 0) {
+            std::cout << files[i] << ": " << result.failed << " of " << result.total << " frames failed" << std::endl;
+            failed++;
+            continue;
+        }
+        std::cout << files[i] << ": " << result.done << " frames in " << seconds << " s" << std::endl;
+    }
+    std::cout << files.size() - failed << " of " << files.size() << " clips done, disk cache ";
+    std::cout << (BlackmagicRAWDiskCache::instance().sizeBytes() >> 20) << " MB" << std::endl;
+#ifdef _WIN32
+    CoUninitialize();
+#endif
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWProxyBuilder.h"
+#include "BlackmagicRAWDiskCache.h"
+#include "BlackmagicRAWSession.h"
+
+#include <deque>
+
+// frames submitted ahead, the scheduler limit decides how many decode at once
+#define kProxyFramesInFlight 8
+
+BlackmagicRAWProxyBuilder::BlackmagicRAWProxyBuilder()
+: _cancelled(false)
+{
+}
+
+BlackmagicRAWProxyBuilder::~BlackmagicRAWProxyBuilder()
+{
+    cancel();
+}
+
+void BlackmagicRAWProxyBuilder::start(const std::string &filename,
+                                      const std::string &path,
+                                      const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                      int quality)
+{
+    cancel();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _progress = Progress();
+        _progress.filename = filename;
+        _progress.quality = quality;
+        _progress.running = true;
+    }
+    _cancelled = false;
+    _thread = std::thread([this, filename, path, specs, quality]() {
+        build(filename, path, specs, quality, [this]() { return _cancelled.load(); }, [this](const Progress &progress) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _progress = progress;
+            _progress.running = true;
+        });
+        std::lock_guard<std::mutex> lock(_mutex);
+        _progress.running = false;
+    });
+}
+
+void BlackmagicRAWProxyBuilder::cancel()
+{
+    _cancelled = true;
+    if (_thread.joinable()) { _thread.join(); }
+}
+
+BlackmagicRAWProxyBuilder::Progress BlackmagicRAWProxyBuilder::progress()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _progress;
+}
+
+bool BlackmagicRAWProxyBuilder::build(const std::string &filename,
+                                      const std::string &path,
+                                      const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                      int quality,
+                                      const AbortCallback &abortCallback,
+                                      const ProgressCallback &progressCallback)
+{
+    BlackmagicRAWDiskCache &disk = BlackmagicRAWDiskCache::instance();
+    if (disk.directory().empty()) { return false; }
+    BlackmagicRAWHandler::BlackmagicRAWSpecs clipSpecs = BlackmagicRAWHandler::getClipSpecs(filename, path);
+    if (clipSpecs.frameMax <= 0) { return false; }
+
+    // a session of its own, renders of the clip keep theirs
+    BlackmagicRAWSession session;
+    if (!session.open(filename, path)) { return false; }
+    BlackmagicRAWHandler::BlackmagicRAWSpecs proxySpecs = specs;
+    proxySpecs.quality = quality;
+    BlackmagicRAWFrameCache::Key key;
+    key.file = BlackmagicRAWHandler::getFileIdentity(filename);
+    key.quality = quality;
+    key.processingHash = BlackmagicRAWHandler::getProcessingHash(proxySpecs);
+
+    Progress progress;
+    progress.filename = filename;
+    progress.quality = quality;
+    progress.total = clipSpecs.frameMax;
+    progress.running = true;
+    std::deque<std::pair<BlackmagicRAWFrameCache::Key, BlackmagicRAWSession::Job> > inFlight;
+    int next = 0;
+    bool aborted = false;
+    while (progress.done + progress.failed < progress.total) {
+        aborted = abortCallback && abortCallback();
+        if (aborted) { break; }
+        while ((int)inFlight.size() < kProxyFramesInFlight && next < progress.total) {
+            key.frame = (uint64_t)next++;
+            // built before, by us or an earlier session
+            if (disk.contains(key)) {
+                progress.done++;
+                continue;
+            }
+            inFlight.push_back(std::make_pair(key, session.submitFrame(key, proxySpecs, BlackmagicRAWScheduler::priorityBackground)));
+        }
+        if (inFlight.empty()) { continue; }
+        BlackmagicRAWFramePtr frame = inFlight.front().second.wait(abortCallback);
+        if (frame && disk.store(inFlight.front().first, frame)) {
+            progress.done++;
+        } else if (!(abortCallback && abortCallback())) {
+            progress.failed++;
+        }
+        inFlight.pop_front();
+        if (progressCallback) { progressCallback(progress); }
+    }
+    for (size_t i = 0; i < inFlight.size(); ++i) {
+        inFlight[i].second.abort();
+    }
+    if (progressCallback) { progressCallback(progress); }
+    return !aborted;
+}
@@ -0,0 +1,91 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWPROXYBUILDER_H
+#define BLACKMAGICRAWPROXYBUILDER_H
+
+#include "BlackmagicRAWHandler.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * Background proxy generation.
+ *
+ * Decodes every frame of a clip at quarter or eighth resolution and keeps it
+ * in the disk cache, under the key a render at that quality looks up. Renders
+ * at a matching render scale or quality setting then read the proxy instead
+ * of decoding. A few frames are in flight at a time as background work of
+ * BlackmagicRAWScheduler, so interactive renders always go first.
+ */
+class BlackmagicRAWProxyBuilder
+{
+public:
+    struct Progress
+    {
+        std::string filename;
+        int quality = BlackmagicRAWHandler::rawQuarterQuality;
+        int done = 0; // frames built or already on disk
+        int failed = 0; // frames that couldn't be decoded or stored
+        int total = 0;
+        bool running = false;
+    };
+    typedef std::function<void(const Progress&)> ProgressCallback;
+    // polled between frames, returns true to stop the build
+    typedef std::function<bool()> AbortCallback;
+
+    BlackmagicRAWProxyBuilder();
+    // cancels a running build and waits for it
+    ~BlackmagicRAWProxyBuilder();
+
+    // build proxies with the processing settings of specs on a background
+    // thread, a running build is cancelled first
+    void start(const std::string &filename,
+               const std::string &path,
+               const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+               int quality);
+    void cancel();
+    Progress progress();
+
+    // build proxies on the calling thread, false if the clip can't be opened,
+    // the disk cache is disabled or the build was aborted
+    static bool build(const std::string &filename,
+                      const std::string &path,
+                      const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                      int quality,
+                      const AbortCallback &abortCallback = AbortCallback(),
+                      const ProgressCallback &progressCallback = ProgressCallback());
+
+private:
+    BlackmagicRAWProxyBuilder(const BlackmagicRAWProxyBuilder&) = delete;
+    BlackmagicRAWProxyBuilder& operator=(const BlackmagicRAWProxyBuilder&) = delete;
+
+    std::mutex _mutex;
+    std::thread _thread;
+    std::atomic<bool> _cancelled;
+    Progress _progress;
+};
+
+#endif // BLACKMAGICRAWPROXYBUILDER_H
@@ -0,0 +1,127 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWResourceManager.h"
+#include "BlackmagicRAWBufferPool.h"
+
+#include <cstring>
+
+BlackmagicRAWResourceManager& BlackmagicRAWResourceManager::instance()
+{
+    // never destroyed, codecs may still hold resources at static destruction
+    static BlackmagicRAWResourceManager* manager = new BlackmagicRAWResourceManager();
+    return *manager;
+}
+
+std::shared_ptr<char> BlackmagicRAWResourceManager::allocate(size_t sizeBytes)
+{
+    return BlackmagicRAWBufferPool::instance().acquire(sizeBytes);
+}
+
+std::shared_ptr<char> BlackmagicRAWResourceManager::share(void *resource)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<void*, std::shared_ptr<char> >::const_iterator it = _resources.find(resource);
+    if (it == _resources.end()) { return std::shared_ptr<char>(); }
+    return it->second;
+}
+
+#ifdef _WIN32
+HRESULT BlackmagicRAWResourceManager::CreateResource(void* /*context*/,
+                                                     void* /*commandQueue*/,
+                                                     unsigned int sizeBytes,
+                                                     BlackmagicRawResourceType type,
+                                                     BlackmagicRawResourceUsage /*usage*/,
+                                                     void** resource)
+#else
+HRESULT BlackmagicRAWResourceManager::CreateResource(void* /*context*/,
+                                                     void* /*commandQueue*/,
+                                                     uint32_t sizeBytes,
+                                                     BlackmagicRawResourceType type,
+                                                     BlackmagicRawResourceUsage /*usage*/,
+                                                     void** resource)
+#endif
+{
+    if (resource == nullptr) { return E_POINTER; }
+    if (type != blackmagicRawResourceTypeBufferCPU) { return E_INVALIDARG; }
+    std::shared_ptr<char> buffer = allocate(sizeBytes);
+    if (!buffer) { return E_OUTOFMEMORY; }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _resources[buffer.get()] = buffer;
+    *resource = buffer.get();
+    return S_OK;
+}
+
+HRESULT BlackmagicRAWResourceManager::ReleaseResource(void* /*context*/,
+                                                      void* /*commandQueue*/,
+                                                      void* resource,
+                                                      BlackmagicRawResourceType type)
+{
+    if (type != blackmagicRawResourceTypeBufferCPU) { return E_INVALIDARG; }
+    std::shared_ptr<char> buffer; // freed outside the lock if this was the last reference
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<void*, std::shared_ptr<char> >::iterator it = _resources.find(resource);
+    if (it == _resources.end()) { return E_INVALIDARG; }
+    buffer.swap(it->second);
+    _resources.erase(it);
+    return S_OK;
+}
+
+#ifdef _WIN32
+HRESULT BlackmagicRAWResourceManager::CopyResource(void* /*context*/,
+                                                   void* /*commandQueue*/,
+                                                   void* source,
+                                                   BlackmagicRawResourceType sourceType,
+                                                   void* destination,
+                                                   BlackmagicRawResourceType destinationType,
+                                                   unsigned int sizeBytes,
+                                                   BOOL /*copyAsync*/)
+#else
+HRESULT BlackmagicRAWResourceManager::CopyResource(void* /*context*/,
+                                                   void* /*commandQueue*/,
+                                                   void* source,
+                                                   BlackmagicRawResourceType sourceType,
+                                                   void* destination,
+                                                   BlackmagicRawResourceType destinationType,
+                                                   uint32_t sizeBytes,
+                                                   bool /*copyAsync*/)
+#endif
+{
+    if (sourceType != blackmagicRawResourceTypeBufferCPU ||
+        destinationType != blackmagicRawResourceTypeBufferCPU) { return E_INVALIDARG; }
+    if (source == nullptr || destination == nullptr) { return E_POINTER; }
+    std::memcpy(destination, source, sizeBytes);
+    return S_OK;
+}
+
+HRESULT BlackmagicRAWResourceManager::GetResourceHostPointer(void* /*context*/,
+                                                             void* /*commandQueue*/,
+                                                             void* resource,
+                                                             BlackmagicRawResourceType resourceType,
+                                                             void** hostPointer)
+{
+    if (hostPointer == nullptr) { return E_POINTER; }
+    if (resourceType != blackmagicRawResourceTypeBufferCPU) { return E_INVALIDARG; }
+    *hostPointer = resource;
+    return S_OK;
+}
@@ -0,0 +1,106 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWRESOURCEMANAGER_H
+#define BLACKMAGICRAWRESOURCEMANAGER_H
+
+#include "BlackmagicRAWHandler.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+/*
+ * Host memory resource manager installed on every session codec.
+ *
+ * Processed images are backed by buffers from BlackmagicRAWBufferPool. The
+ * SDK only holds a reference to them, so a frame can take over the buffer of
+ * a processed image (see share) instead of copying it, and keep it after the
+ * image and codec are gone. Only CPU buffers are supported.
+ */
+class BlackmagicRAWResourceManager : public IBlackmagicRawResourceManager
+{
+public:
+    static BlackmagicRAWResourceManager& instance();
+
+    // pooled host buffer, also used for the manual decoder buffers
+    static std::shared_ptr<char> allocate(size_t sizeBytes);
+    // reference to a resource created by CreateResource, empty if it isn't ours
+    std::shared_ptr<char> share(void *resource);
+
+#ifdef _WIN32
+    virtual HRESULT STDMETHODCALLTYPE CreateResource(void* context,
+                                                     void* commandQueue,
+                                                     unsigned int sizeBytes,
+                                                     BlackmagicRawResourceType type,
+                                                     BlackmagicRawResourceUsage usage,
+                                                     void** resource);
+#else
+    virtual HRESULT CreateResource(void* context,
+                                   void* commandQueue,
+                                   uint32_t sizeBytes,
+                                   BlackmagicRawResourceType type,
+                                   BlackmagicRawResourceUsage usage,
+                                   void** resource);
+#endif
+    virtual HRESULT STDMETHODCALLTYPE ReleaseResource(void* context,
+                                                      void* commandQueue,
+                                                      void* resource,
+                                                      BlackmagicRawResourceType type);
+#ifdef _WIN32
+    virtual HRESULT STDMETHODCALLTYPE CopyResource(void* context,
+                                                   void* commandQueue,
+                                                   void* source,
+                                                   BlackmagicRawResourceType sourceType,
+                                                   void* destination,
+                                                   BlackmagicRawResourceType destinationType,
+                                                   unsigned int sizeBytes,
+                                                   BOOL copyAsync);
+#else
+    virtual HRESULT CopyResource(void* context,
+                                 void* commandQueue,
+                                 void* source,
+                                 BlackmagicRawResourceType sourceType,
+                                 void* destination,
+                                 BlackmagicRawResourceType destinationType,
+                                 uint32_t sizeBytes,
+                                 bool copyAsync);
+#endif
+    virtual HRESULT STDMETHODCALLTYPE GetResourceHostPointer(void* context,
+                                                             void* commandQueue,
+                                                             void* resource,
+                                                             BlackmagicRawResourceType resourceType,
+                                                             void** hostPointer);
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, LPVOID*) { return E_NOTIMPL; }
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 0; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 0; }
+
+private:
+    BlackmagicRAWResourceManager() = default;
+    virtual ~BlackmagicRAWResourceManager() = default;
+
+    std::mutex _mutex;
+    std::map<void*, std::shared_ptr<char> > _resources; // references held by the SDK
+};
+
+#endif // BLACKMAGICRAWRESOURCEMANAGER_H
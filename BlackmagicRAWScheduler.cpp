@@ -0,0 +1,177 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWScheduler.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#define kSchedulerLimitDefault 4
+
+BlackmagicRAWScheduler& BlackmagicRAWScheduler::instance()
+{
+    // never destroyed, its thread runs for the lifetime of the process
+    static BlackmagicRAWScheduler* scheduler = new BlackmagicRAWScheduler();
+    return *scheduler;
+}
+
+BlackmagicRAWScheduler::BlackmagicRAWScheduler()
+: _nextTicket(1)
+, _limit(kSchedulerLimitDefault)
+, _starting(nullptr)
+, _threadStarted(false)
+{
+}
+
+uint64_t BlackmagicRAWScheduler::newTicket()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nextTicket++;
+}
+
+void BlackmagicRAWScheduler::submit(uint64_t ticket,
+                                    const void *owner,
+                                    Priority priority,
+                                    const Callback &start,
+                                    const Callback &abort,
+                                    const Callback &cancel)
+{
+    Entry entry;
+    entry.owner = owner;
+    entry.priority = priority;
+    entry.start = start;
+    entry.abort = abort;
+    entry.cancel = cancel;
+
+    std::vector<Callback> aborts;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (priority != priorityInteractive) {
+            if (!_threadStarted) {
+                std::thread(&BlackmagicRAWScheduler::run, this).detach();
+                _threadStarted = true;
+            }
+            _queue[QueueKey(priority, ticket)] = entry;
+            _condition.notify_all();
+            return;
+        }
+
+        // make room by aborting background work, most recently started first
+        int excess = (int)_running.size() + 1 - _limit;
+        for (std::map<uint64_t, Entry>::reverse_iterator it = _running.rbegin();
+             it != _running.rend() && excess > 0; ++it) {
+            if (it->second.priority == priorityBackground && !it->second.aborted) {
+                it->second.aborted = true;
+                aborts.push_back(it->second.abort);
+                --excess;
+            }
+        }
+        _running[ticket] = entry;
+    }
+    for (size_t i = 0; i < aborts.size(); ++i) {
+        if (aborts[i]) { aborts[i](); }
+    }
+    start();
+}
+
+void BlackmagicRAWScheduler::finish(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_running.erase(ticket) > 0) {
+        _condition.notify_all();
+    }
+}
+
+void BlackmagicRAWScheduler::cancel(uint64_t ticket)
+{
+    Callback cancel;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::map<QueueKey, Entry>::iterator it = _queue.begin(); it != _queue.end(); ++it) {
+            if (it->first.second == ticket) {
+                cancel = it->second.cancel;
+                _queue.erase(it);
+                break;
+            }
+        }
+    }
+    if (cancel) { cancel(); }
+}
+
+void BlackmagicRAWScheduler::cancelAll(const void *owner)
+{
+    std::vector<Callback> cancels;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<QueueKey, Entry>::iterator it = _queue.begin();
+        while (it != _queue.end()) {
+            if (it->second.owner == owner) {
+                cancels.push_back(it->second.cancel);
+                _queue.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (size_t i = 0; i < cancels.size(); ++i) {
+        if (cancels[i]) { cancels[i](); }
+    }
+}
+
+void BlackmagicRAWScheduler::wait(const void *owner)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _condition.wait(lock, [&]() { return _starting != owner; });
+}
+
+void BlackmagicRAWScheduler::setLimit(int limit)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _limit = std::max(1, limit);
+    _condition.notify_all();
+}
+
+int BlackmagicRAWScheduler::limit()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _limit;
+}
+
+void BlackmagicRAWScheduler::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _condition.wait(lock, [&]() { return !_queue.empty() && (int)_running.size() < _limit; });
+        std::map<QueueKey, Entry>::iterator it = _queue.begin();
+        Entry entry = it->second;
+        _running[it->first.second] = entry;
+        _queue.erase(it);
+        _starting = entry.owner;
+        lock.unlock();
+        entry.start();
+        lock.lock();
+        _starting = nullptr;
+        _condition.notify_all();
+    }
+}
@@ -0,0 +1,108 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWSCHEDULER_H
+#define BLACKMAGICRAWSCHEDULER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+/*
+ * Process-wide admission control for frames submitted to the SDK.
+ *
+ * At most limit() frames of read-ahead and background work are in flight on
+ * all codecs together, the rest wait in priority order and are started from
+ * the scheduler thread as slots free up. Interactive frames (the ones a
+ * render is waiting for) are never queued: they start right away and abort
+ * running background work to make room, queued lower priority work simply
+ * goes after them.
+ */
+class BlackmagicRAWScheduler
+{
+public:
+    enum Priority
+    {
+        priorityInteractive = 0, // a render is waiting for the frame
+        priorityPlayback, // read-ahead of the play head
+        priorityBackground // speculative work, aborted when in the way
+    };
+    typedef std::function<void()> Callback;
+
+    static BlackmagicRAWScheduler& instance();
+
+    // unique ticket to submit work with
+    uint64_t newTicket();
+    // run start now (in the calling thread) or once a slot is free (in the
+    // scheduler thread). abort is called if running work is pre-empted,
+    // cancel if queued work is dropped before it started. Started work must
+    // call finish() when done
+    void submit(uint64_t ticket,
+                const void *owner,
+                Priority priority,
+                const Callback &start,
+                const Callback &abort,
+                const Callback &cancel);
+    // running work is done, frees its slot
+    void finish(uint64_t ticket);
+    // drop the work if it's still queued
+    void cancel(uint64_t ticket);
+    // drop all queued work of owner
+    void cancelAll(const void *owner);
+    // wait until the scheduler thread isn't starting work of owner, must not
+    // be called while holding a lock start takes
+    void wait(const void *owner);
+    // frames of non-interactive work in flight at once
+    void setLimit(int limit);
+    int limit();
+
+private:
+    struct Entry
+    {
+        const void *owner = nullptr;
+        Priority priority = priorityInteractive;
+        Callback start;
+        Callback abort;
+        Callback cancel;
+        bool aborted = false;
+    };
+    typedef std::pair<int, uint64_t> QueueKey; // priority, then submission order
+
+    BlackmagicRAWScheduler();
+    BlackmagicRAWScheduler(const BlackmagicRAWScheduler&) = delete;
+    BlackmagicRAWScheduler& operator=(const BlackmagicRAWScheduler&) = delete;
+    void run();
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    uint64_t _nextTicket;
+    int _limit;
+    std::map<QueueKey, Entry> _queue;
+    std::map<uint64_t, Entry> _running;
+    const void *_starting; // owner the scheduler thread is starting work of
+    bool _threadStarted;
+};
+
+#endif // BLACKMAGICRAWSCHEDULER_H
@@ -0,0 +1,698 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWSession.h"
+#include "BlackmagicRAWBenchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// decoded frames kept per session for re-processing
+#define kDecodedFrameCount 4
+// how often a waiting render checks if the host aborted it
+#define kAbortPollMilliseconds 5
+
+namespace {
+// frame from a processed image, takes over our own buffer (the manual
+// decoder one, or one from the resource manager) and only copies SDK memory
+BlackmagicRAWFramePtr makeFrame(IBlackmagicRawProcessedImage *image,
+                                const std::shared_ptr<char> &buffer,
+                                bool handOff)
+{
+    void *resource = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t sizeBytes = 0;
+    image->GetResource(&resource);
+    image->GetWidth(&width);
+    image->GetHeight(&height);
+    image->GetResourceSizeBytes(&sizeBytes);
+    if (resource == nullptr || width == 0 || height == 0 ||
+        sizeBytes < (uint64_t)width * height * 3 * sizeof(float)) {
+        return BlackmagicRAWFramePtr();
+    }
+    if (buffer && buffer.get() == resource) {
+        return std::make_shared<BlackmagicRAWFrame>(width, height, buffer);
+    }
+    if (handOff) {
+        std::shared_ptr<char> storage = BlackmagicRAWResourceManager::instance().share(resource);
+        if (storage) { return std::make_shared<BlackmagicRAWFrame>(width, height, storage); }
+    }
+    std::shared_ptr<BlackmagicRAWFrame> frame = std::make_shared<BlackmagicRAWFrame>(width, height);
+    std::memcpy(frame->data(), resource, frame->sizeBytes());
+    return frame;
+}
+
+bool sameSource(const BlackmagicRAWFrameCache::Key &a,
+                const BlackmagicRAWFrameCache::Key &b)
+{
+    return a.file == b.file && a.frame == b.frame && a.quality == b.quality;
+}
+}
+
+// the SDK job a request is currently waiting for, shared with its Job handle
+class BlackmagicRAWSession::JobState
+{
+public:
+    JobState()
+    : ticket(BlackmagicRAWScheduler::instance().newTicket())
+    , _job(nullptr)
+    , _aborted(false)
+    {
+    }
+    ~JobState() { release(nullptr); }
+
+    // make job the outstanding one, false if we were aborted in the meantime
+    bool track(IBlackmagicRawJob *job)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_aborted) { return false; }
+        if (_job != nullptr) { _job->Release(); }
+        job->AddRef();
+        _job = job;
+        return true;
+    }
+    // stop tracking job, or whatever job is tracked if nullptr
+    void release(IBlackmagicRawJob *job)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_job != nullptr && (job == nullptr || job == _job)) {
+            _job->Release();
+            _job = nullptr;
+        }
+    }
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        if (_job != nullptr) { _job->Abort(); }
+    }
+    bool isAborted()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _aborted;
+    }
+
+    const uint64_t ticket;
+    // set by the request, from admission until the frame completes
+    std::chrono::steady_clock::time_point started;
+    double seconds = 0.;
+
+private:
+    std::mutex _mutex;
+    IBlackmagicRawJob *_job;
+    bool _aborted;
+};
+
+void BlackmagicRAWSession::Job::abort()
+{
+    if (_state) {
+        _state->abort();
+        BlackmagicRAWScheduler::instance().cancel(_state->ticket);
+    }
+}
+
+double BlackmagicRAWSession::Job::decodeSeconds() const
+{
+    return isReady() ? _state->seconds : 0.;
+}
+
+bool BlackmagicRAWSession::Job::isReady() const
+{
+    return frame.valid() && frame.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+BlackmagicRAWFramePtr BlackmagicRAWSession::Job::wait(const AbortCallback &abortCallback)
+{
+    if (!frame.valid()) { return BlackmagicRAWFramePtr(); }
+    if (abortCallback) {
+        while (frame.wait_for(std::chrono::milliseconds(kAbortPollMilliseconds)) != std::future_status::ready) {
+            if (abortCallback()) {
+                // the job may still write into its destination until the running stage stops
+                abort();
+                frame.wait();
+                return BlackmagicRAWFramePtr();
+            }
+        }
+    }
+    return frame.get();
+}
+
+class BlackmagicRAWSession::Request : public BlackmagickRAWRenderRequest
+{
+public:
+    Request(BlackmagicRAWSession *session,
+            const BlackmagicRAWFrameCache::Key &key,
+            const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs)
+    : session(session)
+    , key(key)
+    , specs(specs)
+    , clip(nullptr)
+    , decoder(nullptr)
+    , handOff(false)
+    , destination(nullptr)
+    , destinationBytes(0)
+    , state(std::make_shared<JobState>())
+    {
+    }
+    ~Request() { state->release(nullptr); }
+
+    virtual void readComplete(HRESULT result,
+                              IBlackmagicRawFrame *frame) override;
+    virtual void decodeComplete(HRESULT result) override;
+    virtual void processComplete(HRESULT result,
+                                 IBlackmagicRawProcessedImage *processedImage) override;
+    // fill the frame state of the decoded frame with our specs
+    HRESULT populateFrameState();
+    // run the process stage on the decoded buffer
+    HRESULT submitProcess();
+    // submit a job of this request, takes over job
+    HRESULT submit(IBlackmagicRawJob *job);
+    void finish(const BlackmagicRAWFramePtr &frame)
+    {
+        BlackmagicRAWScheduler::instance().finish(state->ticket);
+        if (frame) {
+            state->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state->started).count();
+        }
+        promise.set_value(frame);
+        delete this;
+    }
+
+    BlackmagicRAWSession *session;
+    BlackmagicRAWFrameCache::Key key;
+    BlackmagicRAWHandler::BlackmagicRAWSpecs specs;
+    IBlackmagicRawClip *clip;
+    IBlackmagicRawManualDecoderFlow1 *decoder;
+    bool handOff;
+    char *destination;
+    size_t destinationBytes;
+    std::promise<BlackmagicRAWFramePtr> promise;
+    std::shared_ptr<JobState> state;
+    DecodedFramePtr decoded; // only used with the manual decoder
+    std::vector<char> frameState;
+    std::shared_ptr<char> processed;
+    std::vector<char> post3DLUT;
+};
+
+void BlackmagicRAWSession::Request::readComplete(HRESULT result,
+                                                 IBlackmagicRawFrame *frame)
+{
+    if (result == S_OK) {
+        result = frame->SetResourceFormat(s_resourceFormat);
+    }
+    if (result == S_OK) {
+        result = BlackmagicRAWHandler::setResolutionScale(frame, specs.quality);
+    }
+
+    if (result == S_OK && decoded) {
+        // manual flow, decode into our own buffer
+        frame->AddRef();
+        decoded->frame = frame;
+        IBlackmagicRawJob *decodeJob = nullptr;
+        uint32_t decodedSizeBytes = 0;
+        result = populateFrameState();
+        if (result == S_OK) {
+            result = decoder->GetDecodedSizeBytes(frameState.data(), &decodedSizeBytes);
+        }
+        if (result == S_OK) {
+            decoded->decoded = BlackmagicRAWResourceManager::allocate(decodedSizeBytes);
+            if (!decoded->decoded) { result = E_OUTOFMEMORY; }
+        }
+        if (result == S_OK) {
+            result = decoder->CreateJobDecode(frameState.data(),
+                                              decoded->bitStream.get(),
+                                              decoded->decoded.get(),
+                                              &decodeJob);
+        }
+        if (result == S_OK) {
+            result = submit(decodeJob);
+        }
+    } else if (result == S_OK) {
+        IBlackmagicRawClipProcessingAttributes *clipAttr = nullptr;
+        IBlackmagicRawFrameProcessingAttributes *frameAttr = nullptr;
+        IBlackmagicRawJob *decodeAndProcessJob = nullptr;
+        result = BlackmagicRAWHandler::cloneProcessingAttributes(clip, frame, specs, &clipAttr, &frameAttr);
+        if (result == S_OK) {
+            result = frame->CreateJobDecodeAndProcessFrame(clipAttr, frameAttr, &decodeAndProcessJob);
+        }
+        if (result == S_OK) {
+            result = submit(decodeAndProcessJob);
+        }
+        if (frameAttr != nullptr) { frameAttr->Release(); }
+        if (clipAttr != nullptr) { clipAttr->Release(); }
+    }
+
+    if (result != S_OK) {
+        if (!state->isAborted()) {
+            std::stringstream errorMsg;
+            errorMsg << "ReadComplete Error code = 0x" << std::hex << result << std::endl;
+            std::cout << errorMsg.str() << std::endl;
+        }
+        finish(BlackmagicRAWFramePtr());
+    }
+}
+
+void BlackmagicRAWSession::Request::decodeComplete(HRESULT result)
+{
+    if (result == S_OK) {
+        session->storeDecoded(decoded);
+        result = submitProcess();
+    }
+    if (result != S_OK) {
+        if (!state->isAborted()) {
+            std::stringstream errorMsg;
+            errorMsg << "DecodeComplete Error code = 0x" << std::hex << result << std::endl;
+            std::cout << errorMsg.str() << std::endl;
+        }
+        finish(BlackmagicRAWFramePtr());
+    }
+}
+
+void BlackmagicRAWSession::Request::processComplete(HRESULT result,
+                                                    IBlackmagicRawProcessedImage *processedImage)
+{
+    BlackmagicRAWFramePtr frame;
+    if (result == S_OK && processedImage != nullptr) {
+        frame = makeFrame(processedImage, processed, handOff);
+    }
+    finish(frame);
+}
+
+HRESULT BlackmagicRAWSession::Request::populateFrameState()
+{
+    HRESULT result = S_OK;
+    IBlackmagicRawClipProcessingAttributes *clipAttr = nullptr;
+    IBlackmagicRawFrameProcessingAttributes *frameAttr = nullptr;
+    uint32_t frameStateSizeBytes = 0;
+    result = BlackmagicRAWHandler::cloneProcessingAttributes(clip, decoded->frame, specs, &clipAttr, &frameAttr);
+    if (result == S_OK) {
+        result = decoder->GetFrameStateSizeBytes(&frameStateSizeBytes);
+    }
+    if (result == S_OK) {
+        frameState.resize(frameStateSizeBytes);
+        result = decoder->PopulateFrameStateBuffer(decoded->frame,
+                                                   clipAttr,
+                                                   frameAttr,
+                                                   frameState.data(),
+                                                   frameStateSizeBytes);
+    }
+    if (frameAttr != nullptr) { frameAttr->Release(); }
+    if (clipAttr != nullptr) { clipAttr->Release(); }
+    return result;
+}
+
+HRESULT BlackmagicRAWSession::Request::submitProcess()
+{
+    HRESULT result = S_OK;
+    IBlackmagicRawJob *processJob = nullptr;
+    uint32_t processedSizeBytes = 0;
+    uint32_t post3DLUTSizeBytes = 0;
+    if (frameState.empty()) {
+        result = populateFrameState();
+    }
+    if (result == S_OK) {
+        result = decoder->GetProcessedSizeBytes(frameState.data(), &processedSizeBytes);
+    }
+    if (result == S_OK) {
+        result = decoder->GetPost3DLUTSizeBytes(frameState.data(), &post3DLUTSizeBytes);
+    }
+    if (result == S_OK) {
+        // process straight into the destination, or into a buffer the frame takes over
+        if (destination != nullptr && destinationBytes == processedSizeBytes) {
+            processed = std::shared_ptr<char>(destination, [](char*) {});
+        } else {
+            processed = BlackmagicRAWResourceManager::allocate(processedSizeBytes);
+        }
+        if (!processed) { result = E_OUTOFMEMORY; }
+    }
+    if (result == S_OK) {
+        post3DLUT.resize(post3DLUTSizeBytes);
+        result = decoder->CreateJobProcess(frameState.data(),
+                                           decoded->decoded.get(),
+                                           processed.get(),
+                                           post3DLUT.empty() ? nullptr : post3DLUT.data(),
+                                           &processJob);
+    }
+    if (result == S_OK) {
+        result = submit(processJob);
+    }
+    return result;
+}
+
+HRESULT BlackmagicRAWSession::Request::submit(IBlackmagicRawJob *job)
+{
+    // tracked before it runs so an abort always reaches it, and never
+    // started once the request is aborted
+    HRESULT result = job->SetUserData(this);
+    if (result == S_OK && !state->track(job)) {
+        result = E_ABORT;
+    }
+    if (result == S_OK) {
+        result = job->Submit();
+    }
+    if (result != S_OK) {
+        state->release(job);
+        job->Release();
+    }
+    return result;
+}
+
+BlackmagicRAWSession::BlackmagicRAWSession()
+: _factory(nullptr)
+, _codec(nullptr)
+, _clip(nullptr)
+, _clipEx(nullptr)
+, _decoder(nullptr)
+, _ownsResources(false)
+, _cpuThreads(0)
+, _appliedCPUThreads(0)
+, _appliedConcurrency(0)
+, _instructionSet(BlackmagicRAWHandler::rawInstructionSetAuto)
+, _appliedInstructionSet(BlackmagicRAWHandler::rawInstructionSetAuto)
+{
+}
+
+BlackmagicRAWSession::~BlackmagicRAWSession()
+{
+    close();
+    // a start the scheduler thread is running may still be waiting for us
+    BlackmagicRAWScheduler::instance().wait(this);
+}
+
+bool BlackmagicRAWSession::open(const std::string &filename,
+                                const std::string &path)
+{
+    // decodes the scheduler lets run at once, auto thread counts share the CPUs between them
+    int concurrency = std::max(1, BlackmagicRAWScheduler::instance().limit());
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (filename.empty() || path.empty()) {
+        closeLocked();
+        return false;
+    }
+
+    BlackmagicRAWHandler::FileIdentity identity = BlackmagicRAWHandler::getFileIdentity(filename);
+    std::function<bool()> isOpenLocked = [&]() {
+        return _clip != nullptr && identity == _identity && path == _libraryPath &&
+               _cpuThreads == _appliedCPUThreads && _instructionSet == _appliedInstructionSet &&
+               (_cpuThreads > 0 || concurrency == _appliedConcurrency);
+    };
+    if (isOpenLocked()) { return true; }
+    closeLocked();
+
+    // measured before our own codec exists so it doesn't compete for the CPU,
+    // and without the lock: the scheduler thread starts the read-ahead of
+    // every instance and must not wait for a benchmark of one clip
+    int bestInstructionSet = BlackmagicRAWHandler::rawInstructionSetAuto;
+    if (_instructionSet == BlackmagicRAWHandler::rawInstructionSetBenchmark) {
+        lock.unlock();
+        bestInstructionSet = BlackmagicRAWBenchmark::getBestInstructionSet(filename, path);
+        lock.lock();
+        // opened by another render in the meantime
+        if (isOpenLocked()) { return true; }
+        closeLocked();
+    }
+    _appliedInstructionSet = _instructionSet;
+    int instructionSet = _instructionSet;
+    if (instructionSet == BlackmagicRAWHandler::rawInstructionSetBenchmark) {
+        instructionSet = bestInstructionSet;
+    }
+
+    HRESULT result = S_OK;
+    do {
+        _factory = BlackmagicRAWHandler::acquireFactory(path);
+        if (_factory == nullptr) {
+            std::cout << "Failed to create IBlackmagicRawFactory!" << std::endl;
+            break;
+        }
+        result = _factory->CreateCodec(&_codec);
+        if (result != S_OK) {
+            std::cout << "Failed to create IBlackmagicRaw!" << std::endl;
+            _codec = nullptr;
+            break;
+        }
+
+        // explicit thread count, or an even share of the CPUs we may use
+        // between the decodes the scheduler lets run at once, so concurrent
+        // codecs don't oversubscribe the CPU quota. Idle codecs don't count,
+        // the share doesn't depend on the order codecs were opened in, and
+        // codecs are opened again with a new share when the limit changes
+        _appliedCPUThreads = _cpuThreads;
+        _appliedConcurrency = concurrency;
+        IBlackmagicRawConfiguration *config = nullptr;
+        if (_codec->QueryInterface(IID_IBlackmagicRawConfiguration, (void**)&config) == S_OK) {
+            uint32_t threads = _cpuThreads > 0 ? _cpuThreads : std::max(1, BlackmagicRAWHandler::getAvailableCPUCount() / concurrency);
+            uint32_t maxThreads = 0;
+            if (config->GetMaxCPUThreadCount(&maxThreads) == S_OK && maxThreads > 0) {
+                threads = std::min(threads, maxThreads);
+            }
+            if (config->SetCPUThreads(threads) != S_OK) {
+                std::cout << "Failed to set CPU threads!" << std::endl;
+            }
+            config->Release();
+        }
+        if (BlackmagicRAWHandler::setInstructionSet(_codec, instructionSet) != S_OK) {
+            std::cout << "Failed to set instruction set!" << std::endl;
+        }
+
+        result = BlackmagicRAWHandler::openClip(_codec, filename, &_clip);
+        if (result != S_OK) {
+            std::cout << "Failed to open IBlackmagicRawClip!" << std::endl;
+            break;
+        }
+        result = _codec->SetCallback(&_callback);
+        if (result != S_OK) {
+            std::cout << "Failed to set IBlackmagicRawCallback!" << std::endl;
+            break;
+        }
+
+        // allocate processed images ourselves so frames can keep them without copying
+        IBlackmagicRawConfigurationEx *configEx = nullptr;
+        if (_codec->QueryInterface(IID_IBlackmagicRawConfigurationEx, (void**)&configEx) == S_OK) {
+            _ownsResources = configEx->SetResourceManager(&BlackmagicRAWResourceManager::instance()) == S_OK;
+            configEx->Release();
+        }
+
+        // split decode/process, falls back to CreateJobDecodeAndProcessFrame if missing
+        if (_codec->QueryInterface(IID_IBlackmagicRawManualDecoderFlow1, (void**)&_decoder) != S_OK ||
+            _clip->QueryInterface(IID_IBlackmagicRawClipEx, (void**)&_clipEx) != S_OK) {
+            if (_decoder != nullptr) { _decoder->Release(); }
+            if (_clipEx != nullptr) { _clipEx->Release(); }
+            _decoder = nullptr;
+            _clipEx = nullptr;
+        }
+
+        _identity = identity;
+        _libraryPath = path;
+        return true;
+    } while(0);
+
+    closeLocked();
+    return false;
+}
+
+void BlackmagicRAWSession::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    closeLocked();
+}
+
+bool BlackmagicRAWSession::isOpen()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _clip != nullptr;
+}
+
+const std::string BlackmagicRAWSession::getFilename()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _clip != nullptr ? _identity.filename : std::string();
+}
+
+void BlackmagicRAWSession::closeLocked()
+{
+    BlackmagicRAWScheduler::instance().cancelAll(this);
+    if (_codec != nullptr) { _codec->FlushJobs(); }
+    {
+        std::lock_guard<std::mutex> lock(_decodedMutex);
+        _decoded.clear();
+    }
+    if (_decoder != nullptr) { _decoder->Release(); }
+    if (_clipEx != nullptr) { _clipEx->Release(); }
+    if (_clip != nullptr) { _clip->Release(); }
+    if (_codec != nullptr) { _codec->Release(); }
+    if (_factory != nullptr) { _factory->Release(); }
+    _decoder = nullptr;
+    _ownsResources = false;
+    _clipEx = nullptr;
+    _clip = nullptr;
+    _codec = nullptr;
+    _factory = nullptr;
+    _identity = BlackmagicRAWHandler::FileIdentity();
+    _libraryPath.clear();
+}
+
+void BlackmagicRAWSession::setCPUThreads(int threads)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cpuThreads = std::max(0, threads);
+}
+
+void BlackmagicRAWSession::setInstructionSet(int instructionSet)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _instructionSet = instructionSet;
+}
+
+BlackmagicRAWSession::DecodedFramePtr
+BlackmagicRAWSession::findDecoded(const BlackmagicRAWFrameCache::Key &key)
+{
+    std::lock_guard<std::mutex> lock(_decodedMutex);
+    for (std::list<DecodedFramePtr>::iterator it = _decoded.begin(); it != _decoded.end(); ++it) {
+        if (sameSource((*it)->key, key)) {
+            _decoded.splice(_decoded.begin(), _decoded, it);
+            return _decoded.front();
+        }
+    }
+    return DecodedFramePtr();
+}
+
+void BlackmagicRAWSession::storeDecoded(const DecodedFramePtr &decoded)
+{
+    std::lock_guard<std::mutex> lock(_decodedMutex);
+    for (std::list<DecodedFramePtr>::iterator it = _decoded.begin(); it != _decoded.end(); ++it) {
+        if (sameSource((*it)->key, decoded->key)) {
+            _decoded.erase(it);
+            break;
+        }
+    }
+    _decoded.push_front(decoded);
+    while (_decoded.size() > kDecodedFrameCount) {
+        _decoded.pop_back();
+    }
+}
+
+BlackmagicRAWSession::Job
+BlackmagicRAWSession::submitFrame(const BlackmagicRAWFrameCache::Key &key,
+                                  const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                  BlackmagicRAWScheduler::Priority priority)
+{
+    return submitFrame(key, specs, nullptr, 0, priority);
+}
+
+BlackmagicRAWSession::Job
+BlackmagicRAWSession::submitFrame(const BlackmagicRAWFrameCache::Key &key,
+                                  const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                  char *destination,
+                                  size_t destinationBytes,
+                                  BlackmagicRAWScheduler::Priority priority)
+{
+    Request *request = new Request(this, key, specs);
+    request->destination = destination;
+    request->destinationBytes = destinationBytes;
+    std::shared_ptr<JobState> state = request->state;
+    Job job;
+    job.frame = request->promise.get_future().share();
+    job._state = state;
+
+    // jobs are created when the scheduler admits the frame, on whatever
+    // codec the session holds by then
+    BlackmagicRAWScheduler::instance().submit(state->ticket,
+                                              this,
+                                              priority,
+                                              [this, request]() {
+                                                  std::lock_guard<std::mutex> lock(_mutex);
+                                                  startLocked(request);
+                                              },
+                                              [state]() { state->abort(); },
+                                              [request]() { request->finish(BlackmagicRAWFramePtr()); });
+    return job;
+}
+
+void BlackmagicRAWSession::startLocked(Request *request)
+{
+    request->state->started = std::chrono::steady_clock::now();
+    const BlackmagicRAWFrameCache::Key &key = request->key;
+    if (_clip == nullptr || key.file != _identity) {
+        request->finish(BlackmagicRAWFramePtr());
+        return;
+    }
+    request->clip = _clip;
+    request->decoder = _decoder;
+    request->handOff = _ownsResources;
+
+    HRESULT result = S_OK;
+    IBlackmagicRawJob* readJob = nullptr;
+    if (_decoder != nullptr) {
+        // already decoded, only run the process stage
+        request->decoded = findDecoded(key);
+        if (request->decoded) {
+            result = request->submitProcess();
+            if (result != S_OK) {
+                if (!request->state->isAborted()) {
+                    std::cout << "Failed to submit process job!" << std::endl;
+                }
+                request->finish(BlackmagicRAWFramePtr());
+            }
+            return;
+        }
+        uint32_t bitStreamSizeBytes = 0;
+        request->decoded = std::make_shared<DecodedFrame>();
+        request->decoded->key = key;
+        result = _clipEx->GetBitStreamSizeBytes(key.frame, &bitStreamSizeBytes);
+        if (result == S_OK) {
+            request->decoded->bitStream = BlackmagicRAWResourceManager::allocate(bitStreamSizeBytes);
+            if (!request->decoded->bitStream) { result = E_OUTOFMEMORY; }
+        }
+        if (result == S_OK) {
+            result = _clipEx->CreateJobReadFrame(key.frame,
+                                                 request->decoded->bitStream.get(),
+                                                 bitStreamSizeBytes,
+                                                 &readJob);
+        }
+    } else {
+        result = _clip->CreateJobReadFrame(key.frame, &readJob);
+    }
+    if (result != S_OK) {
+        std::cout << "Failed to create IBlackmagicRawJob!" << std::endl;
+        request->finish(BlackmagicRAWFramePtr());
+        return;
+    }
+    result = request->submit(readJob);
+    if (result != S_OK) {
+        if (!request->state->isAborted()) {
+            std::cout << "Failed to submit IBlackmagicRawJob!" << std::endl;
+        }
+        request->finish(BlackmagicRAWFramePtr());
+    }
+}
+
+BlackmagicRAWFramePtr
+BlackmagicRAWSession::decodeFrame(const BlackmagicRAWFrameCache::Key &key,
+                                  const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                  char *destination,
+                                  size_t destinationBytes,
+                                  const AbortCallback &abortCallback)
+{
+    return submitFrame(key, specs, destination, destinationBytes, BlackmagicRAWScheduler::priorityInteractive).wait(abortCallback);
+}
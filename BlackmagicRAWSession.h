@@ -0,0 +1,155 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWSESSION_H
+#define BLACKMAGICRAWSESSION_H
+
+#include "BlackmagicRAWHandler.h"
+#include "BlackmagicRAWFrameCache.h"
+#include "BlackmagicRAWResourceManager.h"
+#include "BlackmagicRAWScheduler.h"
+
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+
+/*
+ * Long-lived codec/clip session owned by a plugin instance.
+ *
+ * Keeps the factory, codec and clip open between renders and only rebuilds
+ * them when the filename, or the size/mtime of the file on disk, changes.
+ *
+ * When the SDK provides IBlackmagicRawManualDecoderFlow1, decoding and
+ * processing run as separate jobs and the last decoded (unprocessed) frames
+ * are kept, so a change to a processing attribute only re-runs processing.
+ */
+class BlackmagicRAWSession
+{
+public:
+    BlackmagicRAWSession();
+    ~BlackmagicRAWSession();
+
+    // open (or reuse) the clip, returns false if the clip can't be opened
+    bool open(const std::string &filename,
+              const std::string &path);
+    void close();
+    bool isOpen();
+    // filename of the open clip, empty if none
+    const std::string getFilename();
+    // SDK CPU threads of the codec, 0 (auto) shares the available CPUs between
+    // all open codecs. Applied the next time the clip is opened
+    void setCPUThreads(int threads);
+    // BlackmagicRAWHandler::BlackmagicRAWInstructionSet of the codec, applied
+    // the next time the clip is opened
+    void setInstructionSet(int instructionSet);
+
+    // polled while waiting for a frame, returns true when the caller gave up
+    typedef std::function<bool()> AbortCallback;
+
+    class JobState;
+    // a submitted frame
+    class Job
+    {
+    public:
+        // abort the outstanding read, decode or process job, the frame
+        // completes empty as soon as the running stage stops
+        void abort();
+        bool isReady() const;
+        // time the finished frame spent on the codec, 0 if it isn't done or failed
+        double decodeSeconds() const;
+        // wait for the frame, aborts the job and returns an empty frame once
+        // abortCallback returns true
+        BlackmagicRAWFramePtr wait(const AbortCallback &abortCallback = AbortCallback());
+
+        std::shared_future<BlackmagicRAWFramePtr> frame;
+
+    private:
+        friend class BlackmagicRAWSession;
+        std::shared_ptr<JobState> _state;
+    };
+
+    // queue a frame without waiting for it, BlackmagicRAWScheduler decides
+    // when it goes to the codec. The result is empty on failure, when
+    // aborted, or if the session no longer holds the file the key refers to
+    Job submitFrame(const BlackmagicRAWFrameCache::Key &key,
+                    const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                    BlackmagicRAWScheduler::Priority priority);
+    // decode and process a frame as interactive work, blocks until it's done or abortCallback
+    // returns true. If a destination is given and the processed image has
+    // exactly its size, the frame is processed straight into it and the
+    // returned frame points to destination (it must not outlive it, and must
+    // not be cached)
+    BlackmagicRAWFramePtr decodeFrame(const BlackmagicRAWFrameCache::Key &key,
+                                      const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                                      char *destination = nullptr,
+                                      size_t destinationBytes = 0,
+                                      const AbortCallback &abortCallback = AbortCallback());
+
+private:
+    class Request;
+    // bit stream and decoded buffer of a frame, independent of processing attributes
+    struct DecodedFrame
+    {
+        BlackmagicRAWFrameCache::Key key;
+        IBlackmagicRawFrame *frame = nullptr;
+        std::shared_ptr<char> bitStream;
+        std::shared_ptr<char> decoded;
+        ~DecodedFrame() { if (frame != nullptr) { frame->Release(); } }
+    };
+    typedef std::shared_ptr<DecodedFrame> DecodedFramePtr;
+
+    BlackmagicRAWSession(const BlackmagicRAWSession&) = delete;
+    BlackmagicRAWSession& operator=(const BlackmagicRAWSession&) = delete;
+    void closeLocked();
+    Job submitFrame(const BlackmagicRAWFrameCache::Key &key,
+                    const BlackmagicRAWHandler::BlackmagicRAWSpecs &specs,
+                    char *destination,
+                    size_t destinationBytes,
+                    BlackmagicRAWScheduler::Priority priority);
+    // create and submit the first job of an admitted request
+    void startLocked(Request *request);
+    DecodedFramePtr findDecoded(const BlackmagicRAWFrameCache::Key &key);
+    void storeDecoded(const DecodedFramePtr &decoded);
+
+    std::mutex _mutex;
+    BlackmagicRAWHandler::FileIdentity _identity;
+    std::string _libraryPath;
+    IBlackmagicRawFactory *_factory;
+    IBlackmagicRaw *_codec;
+    IBlackmagicRawClip *_clip;
+    IBlackmagicRawClipEx *_clipEx;
+    IBlackmagicRawManualDecoderFlow1 *_decoder;
+    bool _ownsResources; // processed images live in BlackmagicRAWResourceManager buffers
+    int _cpuThreads; // requested, 0 is auto
+    int _appliedCPUThreads; // requested value the codec was configured with
+    int _appliedConcurrency; // scheduler limit an auto thread count was shared by
+    int _instructionSet;
+    int _appliedInstructionSet;
+    BlackmagickRAWRendererCallback _callback;
+
+    std::mutex _decodedMutex;
+    std::list<DecodedFramePtr> _decoded; // most recently used first
+};
+
+#endif // BLACKMAGICRAWSESSION_H
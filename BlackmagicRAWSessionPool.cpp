@@ -0,0 +1,106 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWSessionPool.h"
+
+// idle sessions kept open, each holds a codec, a clip and decoded frames
+#define kMaxIdleSessions 4
+
+BlackmagicRAWSessionPool::BlackmagicRAWSessionPool()
+: _cpuThreads(0)
+, _instructionSet(BlackmagicRAWHandler::rawInstructionSetAuto)
+{
+}
+
+BlackmagicRAWSessionPool::~BlackmagicRAWSessionPool()
+{
+    // checked out sessions must be released first, they come back here
+    clear();
+}
+
+BlackmagicRAWSessionPool::SessionPtr BlackmagicRAWSessionPool::acquire(const std::string &filename)
+{
+    BlackmagicRAWSession *session = nullptr;
+    int cpuThreads;
+    int instructionSet;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = _idle.size(); i > 0 && session == nullptr; --i) {
+            if (_idle[i - 1]->getFilename() == filename) {
+                session = _idle[i - 1];
+                _idle.erase(_idle.begin() + (i - 1));
+            }
+        }
+        if (session == nullptr && !_idle.empty()) {
+            session = _idle.back();
+            _idle.pop_back();
+        }
+        cpuThreads = _cpuThreads;
+        instructionSet = _instructionSet;
+    }
+    if (session == nullptr) {
+        session = new BlackmagicRAWSession();
+    }
+    session->setCPUThreads(cpuThreads);
+    session->setInstructionSet(instructionSet);
+    return SessionPtr(session, [this](BlackmagicRAWSession *released) { release(released); });
+}
+
+void BlackmagicRAWSessionPool::release(BlackmagicRAWSession *session)
+{
+    BlackmagicRAWSession *evicted = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _idle.push_back(session);
+        if (_idle.size() > kMaxIdleSessions) {
+            evicted = _idle.front();
+            _idle.erase(_idle.begin());
+        }
+    }
+    // closing flushes the codec, not under the pool lock
+    delete evicted;
+}
+
+void BlackmagicRAWSessionPool::setCPUThreads(int threads)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cpuThreads = threads;
+}
+
+void BlackmagicRAWSessionPool::setInstructionSet(int instructionSet)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _instructionSet = instructionSet;
+}
+
+void BlackmagicRAWSessionPool::clear()
+{
+    std::vector<BlackmagicRAWSession*> idle;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        idle.swap(_idle);
+    }
+    for (size_t i = 0; i < idle.size(); ++i) {
+        delete idle[i];
+    }
+}
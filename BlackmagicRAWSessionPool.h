@@ -0,0 +1,68 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWSESSIONPOOL_H
+#define BLACKMAGICRAWSESSIONPOOL_H
+
+#include "BlackmagicRAWSession.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Sessions of a plugin instance for concurrent render threads.
+ *
+ * A render checks a session out for the duration of the call and gets it
+ * back into the pool when the returned pointer is released. Idle sessions
+ * keep their clip open, and a session that already holds the requested
+ * file is preferred, so parallel renders of one clip don't reopen it.
+ */
+class BlackmagicRAWSessionPool
+{
+public:
+    typedef std::shared_ptr<BlackmagicRAWSession> SessionPtr;
+
+    BlackmagicRAWSessionPool();
+    ~BlackmagicRAWSessionPool();
+
+    // a session for the calling thread only, preferably holding filename
+    SessionPtr acquire(const std::string &filename);
+    // applied to every session the next time it's checked out
+    void setCPUThreads(int threads);
+    void setInstructionSet(int instructionSet);
+    // close the idle sessions
+    void clear();
+
+private:
+    BlackmagicRAWSessionPool(const BlackmagicRAWSessionPool&) = delete;
+    BlackmagicRAWSessionPool& operator=(const BlackmagicRAWSessionPool&) = delete;
+    void release(BlackmagicRAWSession *session);
+
+    std::mutex _mutex;
+    std::vector<BlackmagicRAWSession*> _idle; // most recently used last
+    int _cpuThreads;
+    int _instructionSet;
+};
+
+#endif // BLACKMAGICRAWSESSIONPOOL_H
@@ -0,0 +1,701 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#include "BlackmagicRAWTransfer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdint.h>
+#include <system_error>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BRAW_TRANSFER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BRAW_TARGET(isa)
+#else
+#include <cpuid.h>
+#define BRAW_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// transfers above this size bypass the cache
+#define kStreamingThreshold ((size_t)8 << 20)
+
+namespace {
+void copyFloatsScalar(const float *src,
+                      float *dst,
+                      size_t count,
+                      bool /*streaming*/)
+{
+    std::memcpy(dst, src, count * sizeof(float));
+}
+
+#ifdef BRAW_TRANSFER_X86
+BRAW_TARGET("sse4.1")
+void copyFloatsSSE41(const float *src,
+                     float *dst,
+                     size_t count,
+                     bool streaming)
+{
+    size_t i = 0;
+    if (streaming) {
+        // align the destination for non-temporal stores
+        while (i < count && ((uintptr_t)(dst + i) & 15)) {
+            dst[i] = src[i];
+            ++i;
+        }
+        for (; i + 16 <= count; i += 16) {
+            __m128 a = _mm_loadu_ps(src + i);
+            __m128 b = _mm_loadu_ps(src + i + 4);
+            __m128 c = _mm_loadu_ps(src + i + 8);
+            __m128 d = _mm_loadu_ps(src + i + 12);
+            _mm_stream_ps(dst + i, a);
+            _mm_stream_ps(dst + i + 4, b);
+            _mm_stream_ps(dst + i + 8, c);
+            _mm_stream_ps(dst + i + 12, d);
+        }
+        _mm_sfence();
+    } else {
+        for (; i + 16 <= count; i += 16) {
+            __m128 a = _mm_loadu_ps(src + i);
+            __m128 b = _mm_loadu_ps(src + i + 4);
+            __m128 c = _mm_loadu_ps(src + i + 8);
+            __m128 d = _mm_loadu_ps(src + i + 12);
+            _mm_storeu_ps(dst + i, a);
+            _mm_storeu_ps(dst + i + 4, b);
+            _mm_storeu_ps(dst + i + 8, c);
+            _mm_storeu_ps(dst + i + 12, d);
+        }
+    }
+    for (; i < count; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+BRAW_TARGET("avx2")
+void copyFloatsAVX2(const float *src,
+                    float *dst,
+                    size_t count,
+                    bool streaming)
+{
+    size_t i = 0;
+    if (streaming) {
+        while (i < count && ((uintptr_t)(dst + i) & 31)) {
+            dst[i] = src[i];
+            ++i;
+        }
+        for (; i + 32 <= count; i += 32) {
+            __m256 a = _mm256_loadu_ps(src + i);
+            __m256 b = _mm256_loadu_ps(src + i + 8);
+            __m256 c = _mm256_loadu_ps(src + i + 16);
+            __m256 d = _mm256_loadu_ps(src + i + 24);
+            _mm256_stream_ps(dst + i, a);
+            _mm256_stream_ps(dst + i + 8, b);
+            _mm256_stream_ps(dst + i + 16, c);
+            _mm256_stream_ps(dst + i + 24, d);
+        }
+        _mm_sfence();
+    } else {
+        for (; i + 32 <= count; i += 32) {
+            __m256 a = _mm256_loadu_ps(src + i);
+            __m256 b = _mm256_loadu_ps(src + i + 8);
+            __m256 c = _mm256_loadu_ps(src + i + 16);
+            __m256 d = _mm256_loadu_ps(src + i + 24);
+            _mm256_storeu_ps(dst + i, a);
+            _mm256_storeu_ps(dst + i + 8, b);
+            _mm256_storeu_ps(dst + i + 16, c);
+            _mm256_storeu_ps(dst + i + 24, d);
+        }
+    }
+    _mm256_zeroupper();
+    for (; i < count; ++i) {
+        dst[i] = src[i];
+    }
+}
+#endif
+
+// average 2x2 pixels of two source rows into count destination pixels
+void halveRowScalar(const float *row0,
+                    const float *row1,
+                    float *dst,
+                    int count)
+{
+    for (int i = 0; i < count; ++i, row0 += 6, row1 += 6, dst += 3) {
+        dst[0] = (row0[0] + row0[3] + row1[0] + row1[3]) * 0.25f;
+        dst[1] = (row0[1] + row0[4] + row1[1] + row1[4]) * 0.25f;
+        dst[2] = (row0[2] + row0[5] + row1[2] + row1[5]) * 0.25f;
+    }
+}
+
+#ifdef BRAW_TRANSFER_X86
+BRAW_TARGET("sse4.1")
+void halveRowSSE41(const float *row0,
+                   const float *row1,
+                   float *dst,
+                   int count)
+{
+    // a pixel and the R of the next are loaded at once, the extra lane is
+    // overwritten by the next destination pixel so the last one is scalar
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    int i = 0;
+    for (; i + 1 < count; ++i, row0 += 6, row1 += 6, dst += 3) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(row0), _mm_loadu_ps(row0 + 3));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(row1), _mm_loadu_ps(row1 + 3));
+        _mm_storeu_ps(dst, _mm_mul_ps(_mm_add_ps(a, b), quarter));
+    }
+    halveRowScalar(row0, row1, dst, count - i);
+}
+#endif
+
+typedef void (*HalveRowFunc)(const float*, const float*, float*, int);
+
+HalveRowFunc getHalveRow()
+{
+    switch (BlackmagicRAWTransfer::getInstructionSet()) {
+#ifdef BRAW_TRANSFER_X86
+    case BlackmagicRAWTransfer::instructionSetAVX2:
+    case BlackmagicRAWTransfer::instructionSetAVX:
+    case BlackmagicRAWTransfer::instructionSetSSE41:
+        return halveRowSSE41;
+#endif
+    default:
+        return halveRowScalar;
+    }
+}
+
+uint16_t floatToHalf(float value)
+{
+    // round to nearest even, overflow to infinity, NaN stays NaN
+    const uint32_t infinity = 255u << 23;
+    const uint32_t halfOverflow = (127u + 16u) << 23;
+    const uint32_t denormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    uint16_t half;
+    if (bits >= halfOverflow) {
+        half = bits > infinity ? 0x7e00 : 0x7c00;
+    } else if (bits < (113u << 23)) {
+        // denormal half, let the FPU do the rounding
+        float denormMagic;
+        std::memcpy(&denormMagic, &denormMagicBits, sizeof(denormMagic));
+        float shifted;
+        std::memcpy(&shifted, &bits, sizeof(shifted));
+        shifted += denormMagic;
+        std::memcpy(&bits, &shifted, sizeof(bits));
+        half = (uint16_t)(bits - denormMagicBits);
+    } else {
+        uint32_t odd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+        half = (uint16_t)(bits >> 13);
+    }
+    return (uint16_t)(half | (sign >> 16));
+}
+
+float halfToFloat(uint16_t half)
+{
+    const uint32_t shiftedExponent = 0x7c00u << 13;
+    const uint32_t magicBits = 113u << 23;
+    uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+    uint32_t exponent = bits & shiftedExponent;
+    bits += (127u - 15u) << 23;
+    if (exponent == shiftedExponent) {
+        bits += (128u - 16u) << 23; // infinity or NaN
+    } else if (exponent == 0) {
+        // denormal, renormalize through the FPU
+        float magic;
+        std::memcpy(&magic, &magicBits, sizeof(magic));
+        bits += 1u << 23;
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        value -= magic;
+        std::memcpy(&bits, &value, sizeof(bits));
+    }
+    bits |= (uint32_t)(half & 0x8000) << 16;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void packHalfScalar(const float *src,
+                    uint16_t *dst,
+                    size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
+
+void unpackHalfScalar(const uint16_t *src,
+                      float *dst,
+                      size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = halfToFloat(src[i]);
+    }
+}
+
+#ifdef BRAW_TRANSFER_X86
+BRAW_TARGET("avx2,f16c")
+void packHalfF16C(const float *src,
+                  uint16_t *dst,
+                  size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        __m128i b = _mm256_cvtps_ph(_mm256_loadu_ps(src + i + 8), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), a);
+        _mm_storeu_si128((__m128i*)(dst + i + 8), b);
+    }
+    _mm256_zeroupper();
+    packHalfScalar(src + i, dst + i, count - i);
+}
+
+BRAW_TARGET("avx2,f16c")
+void unpackHalfF16C(const uint16_t *src,
+                    float *dst,
+                    size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+        _mm256_storeu_ps(dst + i, a);
+        _mm256_storeu_ps(dst + i + 8, b);
+    }
+    _mm256_zeroupper();
+    unpackHalfScalar(src + i, dst + i, count - i);
+}
+
+bool hasF16C()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 29)) != 0;
+#else
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 29)) != 0;
+#endif
+}
+#endif
+
+typedef void (*PackHalfFunc)(const float*, uint16_t*, size_t);
+typedef void (*UnpackHalfFunc)(const uint16_t*, float*, size_t);
+
+// F16C comes with every AVX2 CPU, but it's a feature bit of its own
+bool useF16C()
+{
+#ifdef BRAW_TRANSFER_X86
+    return BlackmagicRAWTransfer::getInstructionSet() == BlackmagicRAWTransfer::instructionSetAVX2 && hasF16C();
+#else
+    return false;
+#endif
+}
+
+PackHalfFunc getPackHalf()
+{
+#ifdef BRAW_TRANSFER_X86
+    if (useF16C()) { return packHalfF16C; }
+#endif
+    return packHalfScalar;
+}
+
+UnpackHalfFunc getUnpackHalf()
+{
+#ifdef BRAW_TRANSFER_X86
+    if (useF16C()) { return unpackHalfF16C; }
+#endif
+    return unpackHalfScalar;
+}
+
+typedef void (*CopyFloatsFunc)(const float*, float*, size_t, bool);
+
+CopyFloatsFunc getCopyFloats()
+{
+    switch (BlackmagicRAWTransfer::getInstructionSet()) {
+#ifdef BRAW_TRANSFER_X86
+    case BlackmagicRAWTransfer::instructionSetAVX2:
+        return copyFloatsAVX2;
+    case BlackmagicRAWTransfer::instructionSetAVX:
+    case BlackmagicRAWTransfer::instructionSetSSE41:
+        return copyFloatsSSE41;
+#endif
+    default:
+        return copyFloatsScalar;
+    }
+}
+}
+
+BlackmagicRAWTransfer::InstructionSet BlackmagicRAWTransfer::getInstructionSet()
+{
+    static const InstructionSet instructionSet = []() {
+#ifdef BRAW_TRANSFER_X86
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        bool sse41 = false;
+        bool avx = false;
+        bool avx2 = false;
+        if (maxLeaf >= 1) {
+            __cpuid(info, 1);
+            sse41 = (info[2] & (1 << 19)) != 0;
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            avx = osxsave && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+            if (maxLeaf >= 7 && avx) {
+                __cpuidex(info, 7, 0);
+                avx2 = (info[1] & (1 << 5)) != 0;
+            }
+        }
+        if (avx2) { return instructionSetAVX2; }
+        if (avx) { return instructionSetAVX; }
+        if (sse41) { return instructionSetSSE41; }
+#else
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) { return instructionSetAVX2; }
+        if (__builtin_cpu_supports("avx")) { return instructionSetAVX; }
+        if (__builtin_cpu_supports("sse4.1")) { return instructionSetSSE41; }
+#endif
+#endif
+        return instructionSetNone;
+    }();
+    return instructionSet;
+}
+
+void BlackmagicRAWTransfer::copyFloats(const float *src,
+                                       float *dst,
+                                       size_t count,
+                                       bool streaming)
+{
+    static const CopyFloatsFunc copy = getCopyFloats();
+    copy(src, dst, count, streaming);
+}
+
+void BlackmagicRAWTransfer::packHalf(const float *src,
+                                     uint16_t *dst,
+                                     size_t count)
+{
+    static const PackHalfFunc pack = getPackHalf();
+    pack(src, dst, count);
+}
+
+void BlackmagicRAWTransfer::unpackHalf(const uint16_t *src,
+                                       float *dst,
+                                       size_t count)
+{
+    static const UnpackHalfFunc unpack = getUnpackHalf();
+    unpack(src, dst, count);
+}
+
+void BlackmagicRAWTransfer::copyRGB(const float *src,
+                                    int srcWidth,
+                                    int srcHeight,
+                                    const Rect &window,
+                                    float *dst,
+                                    const Rect &bounds,
+                                    int dstRowBytes)
+{
+    // only ever write inside bounds
+    int x1 = std::max(window.x1, bounds.x1);
+    int x2 = std::min(window.x2, bounds.x2);
+    int y1 = std::max(window.y1, bounds.y1);
+    int y2 = std::min(window.y2, bounds.y2);
+    if (src == nullptr || dst == nullptr || x1 >= x2 || y1 >= y2) { return; }
+
+    // part of the window covered by the frame
+    int cx1 = std::max(x1, 0);
+    int cx2 = std::min(x2, srcWidth);
+    size_t rowCount = cx2 > cx1 ? (size_t)(cx2 - cx1) * 3 : 0;
+    bool streaming = rowCount * sizeof(float) * (size_t)(y2 - y1) >= kStreamingThreshold;
+
+    for (int y = y1; y < y2; ++y) {
+        float *dstRow = (float*)((char*)dst + (ptrdiff_t)(y - bounds.y1) * dstRowBytes) + (size_t)(x1 - bounds.x1) * 3;
+        if (y < 0 || y >= srcHeight || rowCount == 0) {
+            std::memset(dstRow, 0, (size_t)(x2 - x1) * 3 * sizeof(float));
+            continue;
+        }
+        if (cx1 > x1) {
+            std::memset(dstRow, 0, (size_t)(cx1 - x1) * 3 * sizeof(float));
+        }
+        const float *srcRow = src + ((size_t)y * srcWidth + cx1) * 3;
+        copyFloats(srcRow, dstRow + (size_t)(cx1 - x1) * 3, rowCount, streaming);
+        if (x2 > cx2) {
+            std::memset(dstRow + (size_t)(cx2 - x1) * 3, 0, (size_t)(x2 - cx2) * 3 * sizeof(float));
+        }
+    }
+}
+
+namespace {
+// source pixels [begin, end) covered by each destination pixel of [from, to),
+// empty outside the source
+void getSpans(int from,
+              int to,
+              double scale,
+              int sourceSize,
+              std::vector<std::pair<int, int> > *spans)
+{
+    spans->resize(to - from);
+    for (int i = from; i < to; ++i) {
+        int begin = (int)std::floor(i / scale);
+        int end = std::max(begin + 1, (int)std::floor((i + 1) / scale));
+        if (begin < 0 || begin >= sourceSize) {
+            begin = end = 0;
+        }
+        (*spans)[i - from] = std::make_pair(begin, std::min(end, sourceSize));
+    }
+}
+
+// every span is exactly the two source pixels of a 2:1 reduction
+bool isHalving(const std::vector<std::pair<int, int> > &spans,
+               int from)
+{
+    for (size_t i = 0; i < spans.size(); ++i) {
+        int begin = 2 * (from + (int)i);
+        if (spans[i].first != begin || spans[i].second != begin + 2) { return false; }
+    }
+    return true;
+}
+}
+
+void BlackmagicRAWTransfer::scaleRGB(const float *src,
+                                     int srcWidth,
+                                     int srcHeight,
+                                     double scaleX,
+                                     double scaleY,
+                                     const Rect &window,
+                                     float *dst,
+                                     const Rect &bounds,
+                                     int dstRowBytes)
+{
+    int x1 = std::max(window.x1, bounds.x1);
+    int x2 = std::min(window.x2, bounds.x2);
+    int y1 = std::max(window.y1, bounds.y1);
+    int y2 = std::min(window.y2, bounds.y2);
+    if (src == nullptr || dst == nullptr || x1 >= x2 || y1 >= y2 ||
+        scaleX <= 0. || scaleY <= 0.) { return; }
+
+    std::vector<std::pair<int, int> > columns;
+    std::vector<std::pair<int, int> > rows;
+    getSpans(x1, x2, scaleX, srcWidth, &columns);
+    getSpans(y1, y2, scaleY, srcHeight, &rows);
+
+    // the common 2:1 remainder goes through the halving kernel
+    static const HalveRowFunc halveRow = getHalveRow();
+    bool halving = isHalving(columns, x1) && isHalving(rows, y1);
+    forEachStrip(y2 - y1, [&](int begin, int end) {
+        for (int y = y1 + begin; y < y1 + end; ++y) {
+            float *dstPixel = (float*)((char*)dst + (ptrdiff_t)(y - bounds.y1) * dstRowBytes) + (size_t)(x1 - bounds.x1) * 3;
+            const std::pair<int, int> &row = rows[y - y1];
+            if (halving) {
+                const float *row0 = src + ((size_t)row.first * srcWidth + columns[0].first) * 3;
+                halveRow(row0, row0 + (size_t)srcWidth * 3, dstPixel, x2 - x1);
+                continue;
+            }
+            for (int x = x1; x < x2; ++x, dstPixel += 3) {
+                const std::pair<int, int> &column = columns[x - x1];
+                float r = 0.f;
+                float g = 0.f;
+                float b = 0.f;
+                for (int sy = row.first; sy < row.second; ++sy) {
+                    const float *srcPixel = src + ((size_t)sy * srcWidth + column.first) * 3;
+                    for (int sx = column.first; sx < column.second; ++sx, srcPixel += 3) {
+                        r += srcPixel[0];
+                        g += srcPixel[1];
+                        b += srcPixel[2];
+                    }
+                }
+                int count = (row.second - row.first) * (column.second - column.first);
+                float weight = count > 0 ? 1.f / count : 0.f;
+                dstPixel[0] = r * weight;
+                dstPixel[1] = g * weight;
+                dstPixel[2] = b * weight;
+            }
+        }
+    });
+}
+
+void BlackmagicRAWTransfer::halveRGB(const float *src,
+                                     int srcWidth,
+                                     int srcHeight,
+                                     float *dst)
+{
+    static const HalveRowFunc halveRow = getHalveRow();
+    int width = srcWidth / 2;
+    int height = srcHeight / 2;
+    if (src == nullptr || dst == nullptr || srcWidth <= 0 || srcHeight <= 0) { return; }
+    if (width == 0 || height == 0) {
+        // a single row or column, only the other direction is averaged
+        int stepX = width == 0 ? 0 : 1;
+        int stepY = height == 0 ? 0 : 1;
+        width = std::max(1, width);
+        height = std::max(1, height);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const float *pixel0 = src + ((size_t)y * 2 * srcWidth + (size_t)x * 2) * 3;
+                const float *pixel1 = pixel0 + ((size_t)stepY * srcWidth + stepX) * 3;
+                float *dstPixel = dst + ((size_t)y * width + x) * 3;
+                for (int c = 0; c < 3; ++c) {
+                    dstPixel[c] = (pixel0[c] + pixel1[c]) * 0.5f;
+                }
+            }
+        }
+        return;
+    }
+    forEachStrip(height, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const float *row0 = src + (size_t)y * 2 * srcWidth * 3;
+            halveRow(row0, row0 + (size_t)srcWidth * 3, dst + (size_t)y * width * 3, width);
+        }
+    });
+}
+
+namespace {
+/*
+ * Worker threads shared by all strip work of the process. Concurrent
+ * renders queue their strips on the same workers instead of starting
+ * threads of their own, and each caller runs strips as well while it waits,
+ * so nested or concurrent calls always make progress.
+ */
+class StripPool
+{
+public:
+    static StripPool& instance()
+    {
+        // never destroyed, its workers run for the lifetime of the process
+        static StripPool* pool = new StripPool();
+        return *pool;
+    }
+
+    // workers plus the calling thread
+    int threadCount() const { return _workerCount + 1; }
+
+    // run func on strips strips of count rows, rethrows the first exception
+    // of func once all strips are done
+    void run(int count,
+             const std::function<void(int begin, int end)> &func,
+             int strips)
+    {
+        Batch batch;
+        batch.func = &func;
+        batch.count = count;
+        batch.strips = strips;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _batches.push_back(&batch);
+        _workCondition.notify_all();
+        while (batch.next < batch.strips) {
+            runStripLocked(lock, &batch);
+        }
+        _doneCondition.wait(lock, [&]() { return batch.done == batch.strips; });
+        lock.unlock();
+        if (batch.error) { std::rethrow_exception(batch.error); }
+    }
+
+private:
+    struct Batch
+    {
+        const std::function<void(int begin, int end)> *func = nullptr;
+        int count = 0;
+        int strips = 0;
+        int next = 0; // strips handed out
+        int done = 0;
+        std::exception_ptr error;
+    };
+
+    StripPool()
+    : _workerCount(0)
+    {
+        int workers = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+        for (int i = 0; i < workers; ++i) {
+            try {
+                std::thread(&StripPool::worker, this).detach();
+            } catch (const std::system_error&) {
+                break; // fewer workers, callers do the rest
+            }
+            ++_workerCount;
+        }
+    }
+
+    // runs the next strip of batch unlocked, the batch leaves the queue
+    // once its last strip is handed out
+    void runStripLocked(std::unique_lock<std::mutex> &lock,
+                        Batch *batch)
+    {
+        int strip = batch->next++;
+        if (batch->next == batch->strips) {
+            _batches.erase(std::find(_batches.begin(), _batches.end(), batch));
+        }
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            (*batch->func)((int)((int64_t)batch->count * strip / batch->strips),
+                           (int)((int64_t)batch->count * (strip + 1) / batch->strips));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !batch->error) { batch->error = error; }
+        if (++batch->done == batch->strips) { _doneCondition.notify_all(); }
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _workCondition.wait(lock, [&]() { return !_batches.empty(); });
+            runStripLocked(lock, _batches.front());
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _workCondition;
+    std::condition_variable _doneCondition;
+    std::deque<Batch*> _batches; // with strips left to hand out
+    int _workerCount;
+};
+}
+
+void BlackmagicRAWTransfer::forEachStrip(int count,
+                                         const std::function<void(int begin, int end)> &func,
+                                         int minCount)
+{
+    int threads = std::min(StripPool::instance().threadCount(), count / std::max(1, minCount));
+    if (threads <= 1) {
+        if (count > 0) { func(0, count); }
+        return;
+    }
+    StripPool::instance().run(count, func, threads);
+}
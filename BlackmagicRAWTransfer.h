@@ -0,0 +1,115 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+#ifndef BLACKMAGICRAWTRANSFER_H
+#define BLACKMAGICRAWTRANSFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Pixel transfer from decoded frames to host buffers.
+ *
+ * Kernels are selected at runtime from the CPU features (AVX2, SSE4.1 or
+ * plain C++). Large transfers use non-temporal stores so a full 12K frame
+ * doesn't evict everything else from the cache on its way to the host.
+ */
+class BlackmagicRAWTransfer
+{
+public:
+    enum InstructionSet
+    {
+        instructionSetNone,
+        instructionSetSSE41,
+        instructionSetAVX,
+        instructionSetAVX2
+    };
+    struct Rect
+    {
+        int x1 = 0;
+        int y1 = 0;
+        int x2 = 0;
+        int y2 = 0;
+    };
+
+    // best instruction set supported by this CPU
+    static InstructionSet getInstructionSet();
+
+    // copy the window of an interleaved RGB float frame (rows bottom-up, origin
+    // at 0,0) into a host buffer starting at the bottom-left of bounds with the
+    // given stride. Window pixels outside the frame are set to 0.
+    static void copyRGB(const float *src,
+                        int srcWidth,
+                        int srcHeight,
+                        const Rect &window,
+                        float *dst,
+                        const Rect &bounds,
+                        int dstRowBytes);
+
+    // same as copyRGB for a window at another scale, scale is destination
+    // pixels per source pixel. Each destination pixel is the average of the
+    // source pixels it covers (nearest pixel when upscaling).
+    static void scaleRGB(const float *src,
+                         int srcWidth,
+                         int srcHeight,
+                         double scaleX,
+                         double scaleY,
+                         const Rect &window,
+                         float *dst,
+                         const Rect &bounds,
+                         int dstRowBytes);
+
+    // 2x2 box average of an interleaved RGB float frame into a frame of
+    // srcWidth / 2 by srcHeight / 2 pixels, an odd last row or column is dropped;
+    // a source one pixel wide or high stays one pixel in that direction
+    static void halveRGB(const float *src,
+                         int srcWidth,
+                         int srcHeight,
+                         float *dst);
+
+    // convert count floats to IEEE half floats, rounding to nearest even,
+    // and back. Uses F16C when the CPU has it
+    static void packHalf(const float *src,
+                         uint16_t *dst,
+                         size_t count);
+    static void unpackHalf(const uint16_t *src,
+                           float *dst,
+                           size_t count);
+
+    // copy count floats
+    static void copyFloats(const float *src,
+                           float *dst,
+                           size_t count,
+                           bool streaming);
+
+    // run func on strips [begin, end) of count rows, on the workers shared by
+    // the process and the calling thread when each strip can get at least
+    // minCount rows. Rethrows the first exception of func
+    static void forEachStrip(int count,
+                             const std::function<void(int begin, int end)> &func,
+                             int minCount = 64);
+};
+
+#endif // BLACKMAGICRAWTRANSFER_H
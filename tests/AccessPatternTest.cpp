@@ -0,0 +1,190 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+// BlackmagicRAWAccessPattern on synthetic access traces
+
+#include "BlackmagicRAWAccessPattern.h"
+
+#include <iostream>
+
+namespace {
+int failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::cout << __FILE__ << ":" << __LINE__ << ": " #condition << std::endl; failures++; } } while (0)
+
+void play(BlackmagicRAWAccessPattern &pattern,
+          const std::vector<int64_t> &frames)
+{
+    for (size_t i = 0; i < frames.size(); ++i) {
+        pattern.record(frames[i]);
+    }
+}
+
+std::vector<int64_t> range(int64_t first,
+                           int64_t last,
+                           int64_t step = 1)
+{
+    std::vector<int64_t> frames;
+    for (int64_t frame = first; step > 0 ? frame <= last : frame >= last; frame += step) {
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+std::vector<int64_t> frames(int64_t a,
+                            int64_t b,
+                            int64_t c)
+{
+    std::vector<int64_t> result;
+    result.push_back(a);
+    result.push_back(b);
+    result.push_back(c);
+    return result;
+}
+
+void testForward()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(0, 5));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternStride);
+    CHECK(pattern.stride() == 1);
+    CHECK(pattern.predict(3, 100, false) == frames(6, 7, 8));
+    // clamped to the clip
+    play(pattern, range(6, 98));
+    CHECK(pattern.predict(3, 100, false) == std::vector<int64_t>(1, 99));
+}
+
+void testReverse()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(20, 15, -1));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternStride);
+    CHECK(pattern.stride() == -1);
+    CHECK(pattern.predict(3, 100, false) == frames(14, 13, 12));
+}
+
+void testStride()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(0, 9, 3));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternStride);
+    CHECK(pattern.stride() == 3);
+    CHECK(pattern.predict(3, 100, false) == frames(12, 15, 18));
+}
+
+void testLoop()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(10, 14));
+    play(pattern, range(10, 12));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternLoop);
+    // several wraps, the pattern holds on every frame
+    for (int wrap = 0; wrap < 4; ++wrap) {
+        play(pattern, range(13, 14));
+        CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternLoop);
+        CHECK(pattern.predict(3, 100, true) == frames(10, 11, 12));
+        for (int64_t frame = 10; frame <= 12; ++frame) {
+            pattern.record(frame);
+            CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternLoop);
+            CHECK(pattern.stride() == 1);
+        }
+        CHECK(pattern.predict(3, 100, true) == frames(13, 14, 10));
+    }
+}
+
+void testReverseLoop()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(14, 10, -1));
+    play(pattern, range(14, 10, -1));
+    play(pattern, range(14, 10, -1));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternLoop);
+    CHECK(pattern.stride() == -1);
+    CHECK(pattern.predict(3, 100, false) == frames(14, 13, 12));
+}
+
+void testStrideLoop()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(0, 6, 2));
+    play(pattern, range(0, 6, 2));
+    play(pattern, range(0, 6, 2));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternLoop);
+    CHECK(pattern.predict(3, 100, false) == frames(0, 2, 4));
+}
+
+void testSeek()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, range(0, 5));
+    pattern.record(50);
+    // a single jump could still be a loop or a seek
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternNone);
+    pattern.record(51);
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternStride);
+    CHECK(pattern.predict(3, 100, false) == frames(52, 53, 54));
+    // a new direction is a new pattern
+    play(pattern, frames(40, 30, 20));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternStride);
+    CHECK(pattern.stride() == -10);
+}
+
+void testRerender()
+{
+    BlackmagicRAWAccessPattern pattern;
+    play(pattern, frames(0, 1, 2));
+    play(pattern, frames(2, 2, 3));
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternStride);
+    CHECK(pattern.predict(3, 100, false) == frames(4, 5, 6));
+}
+
+void testGuess()
+{
+    BlackmagicRAWAccessPattern pattern;
+    CHECK(pattern.predict(3, 100, true).empty());
+    pattern.record(5);
+    CHECK(pattern.kind() == BlackmagicRAWAccessPattern::patternNone);
+    CHECK(pattern.predict(3, 100, false).empty());
+    CHECK(pattern.predict(3, 100, true) == frames(6, 7, 8));
+    pattern.record(3);
+    CHECK(pattern.predict(3, 100, true) == frames(2, 1, 0));
+    pattern.reset();
+    CHECK(pattern.predict(3, 100, true).empty());
+}
+}
+
+int main()
+{
+    testForward();
+    testReverse();
+    testStride();
+    testLoop();
+    testReverseLoop();
+    testStrideLoop();
+    testSeek();
+    testRerender();
+    testGuess();
+    std::cout << (failures == 0 ? "ok" : "FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+// BlackmagicRAWCompressedFrame and BlackmagicRAWDiskCache round trips on
+// synthetic frames, and the budgets of the BlackmagicRAWFrameCache tiers
+
+#include "BlackmagicRAWBufferPool.h"
+#include "BlackmagicRAWCompressedFrame.h"
+#include "BlackmagicRAWDiskCache.h"
+#include "BlackmagicRAWTransfer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+int failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::cout << __FILE__ << ":" << __LINE__ << ": " #condition << std::endl; failures++; } } while (0)
+
+bool sameFrame(const BlackmagicRAWFramePtr &a,
+               const BlackmagicRAWFramePtr &b)
+{
+    return a && b && a->width() == b->width() && a->height() == b->height() &&
+           a->format() == b->format() &&
+           std::memcmp(a->data(), b->data(), a->sizeBytes()) == 0;
+}
+
+void checkRoundTrip(const std::shared_ptr<BlackmagicRAWFrame> &frame)
+{
+    BlackmagicRAWCompressedFramePtr compressed = BlackmagicRAWCompressedFrame::compress(*frame);
+    CHECK(compressed);
+    if (!compressed) { return; }
+    CHECK(sameFrame(compressed->decompress(), frame));
+}
+
+// every frame in both formats, filled by fill with the index of each value
+void checkRoundTrips(int width,
+                     int height,
+                     const std::function<uint32_t(size_t)> &fill)
+{
+    std::shared_ptr<BlackmagicRAWFrame> frame = std::make_shared<BlackmagicRAWFrame>(width, height);
+    std::shared_ptr<BlackmagicRAWFrame> half = std::make_shared<BlackmagicRAWFrame>(width, height, BlackmagicRAWFrame::formatRGBF16);
+    size_t count = (size_t)width * height * 3;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t value = fill(i);
+        std::memcpy(frame->data() + i, &value, sizeof(value));
+        half->halfData()[i] = (uint16_t)(value >> 16);
+    }
+    checkRoundTrip(frame);
+    checkRoundTrip(half);
+}
+
+uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void testCompressedZeros()
+{
+    checkRoundTrips(64, 40, [](size_t) { return 0u; });
+}
+
+void testCompressedGradient()
+{
+    checkRoundTrips(67, 45, [](size_t i) { return floatBits((float)(i % (67 * 3)) / (67 * 3) + (float)(i / (67 * 3)) * 0.01f); });
+}
+
+void testCompressedRandom()
+{
+    std::mt19937 random(1);
+    checkRoundTrips(64, 33, [&](size_t) { return (uint32_t)random(); });
+}
+
+void testCompressedSpecialValues()
+{
+    const uint32_t values[] = {
+        floatBits(std::numeric_limits<float>::quiet_NaN()),
+        floatBits(-std::numeric_limits<float>::quiet_NaN()),
+        0x7fa00001u, // signalling NaN with a payload
+        floatBits(std::numeric_limits<float>::infinity()),
+        floatBits(-std::numeric_limits<float>::infinity()),
+        floatBits(-0.f),
+        floatBits(std::numeric_limits<float>::denorm_min()),
+        floatBits(std::numeric_limits<float>::max()),
+    };
+    const size_t count = sizeof(values) / sizeof(values[0]);
+    checkRoundTrips(31, 19, [&](size_t i) { return values[i % count]; });
+}
+
+void testCompressedSinglePixel()
+{
+    checkRoundTrips(1, 1, [](size_t i) { return floatBits(0.25f * i); });
+    checkRoundTrips(1, 17, [](size_t i) { return floatBits(0.25f * i); });
+    checkRoundTrips(17, 1, [](size_t i) { return floatBits(0.25f * i); });
+}
+
+std::vector<std::string> listFrames(const std::string &directory)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) { return names; }
+    struct dirent *item;
+    while ((item = readdir(dir)) != nullptr) {
+        std::string name(item->d_name);
+        if (name.size() > 6 && name.compare(name.size() - 6, 6, ".frame") == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+size_t directorySize(const std::string &directory)
+{
+    size_t size = 0;
+    std::vector<std::string> names = listFrames(directory);
+    for (size_t i = 0; i < names.size(); ++i) {
+        struct stat info;
+        if (stat((directory + "/" + names[i]).c_str(), &info) == 0) { size += (size_t)info.st_size; }
+    }
+    return size;
+}
+
+void clearDirectory(const std::string &directory)
+{
+    std::vector<std::string> names = listFrames(directory);
+    for (size_t i = 0; i < names.size(); ++i) {
+        remove((directory + "/" + names[i]).c_str());
+    }
+}
+
+// forget the index, as a new process would
+void reindex(const std::string &directory)
+{
+    BlackmagicRAWDiskCache::instance().setDirectory(std::string());
+    BlackmagicRAWDiskCache::instance().setDirectory(directory);
+}
+
+BlackmagicRAWFrameCache::Key getKey(uint64_t frame)
+{
+    BlackmagicRAWFrameCache::Key key;
+    key.file.filename = "/clips/A001_C001.braw";
+    key.file.size = 123456789;
+    key.file.mtime = 1600000000;
+    key.frame = frame;
+    key.quality = BlackmagicRAWHandler::rawFullQuality;
+    key.processingHash = 42;
+    return key;
+}
+
+BlackmagicRAWFramePtr getFrame(int width,
+                               int height,
+                               float base)
+{
+    std::shared_ptr<BlackmagicRAWFrame> frame = std::make_shared<BlackmagicRAWFrame>(width, height);
+    size_t count = (size_t)width * height * 3;
+    for (size_t i = 0; i < count; ++i) {
+        frame->data()[i] = base + (float)i;
+    }
+    frame->data()[0] = std::numeric_limits<float>::quiet_NaN();
+    return frame;
+}
+
+void testDiskRoundTrip(const std::string &directory)
+{
+    BlackmagicRAWDiskCache &disk = BlackmagicRAWDiskCache::instance();
+    clearDirectory(directory);
+    reindex(directory);
+    BlackmagicRAWFrameCache::Key key = getKey(1);
+    BlackmagicRAWFramePtr frame = getFrame(37, 21, 0.5f);
+    CHECK(!disk.contains(key));
+    CHECK(!disk.read(key));
+    CHECK(disk.store(key, frame));
+    CHECK(disk.contains(key));
+    CHECK(sameFrame(disk.read(key), frame));
+    CHECK(listFrames(directory).size() == 1);
+
+    // found again by a later session
+    reindex(directory);
+    CHECK(disk.contains(key));
+    CHECK(sameFrame(disk.read(key), frame));
+
+    // half float frames are stored as RGBF32
+    BlackmagicRAWFrameCache::Key halfKey = getKey(2);
+    std::shared_ptr<BlackmagicRAWFrame> half = std::make_shared<BlackmagicRAWFrame>(37, 21, BlackmagicRAWFrame::formatRGBF16);
+    for (size_t i = 0; i < (size_t)37 * 21 * 3; ++i) {
+        half->halfData()[i] = (uint16_t)(0x3c00 + i); // 1 and up
+    }
+    CHECK(disk.store(halfKey, half));
+    BlackmagicRAWFramePtr read = disk.read(halfKey);
+    CHECK(read && read->format() == BlackmagicRAWFrame::formatRGBF32);
+    if (read) {
+        std::vector<float> expected((size_t)37 * 21 * 3);
+        BlackmagicRAWTransfer::unpackHalf(half->halfData(), &expected[0], expected.size());
+        CHECK(std::memcmp(read->data(), &expected[0], expected.size() * sizeof(float)) == 0);
+    }
+
+    // a changed clip is another key
+    BlackmagicRAWFrameCache::Key changed = key;
+    changed.file.mtime++;
+    CHECK(!disk.contains(changed));
+    CHECK(!disk.read(changed));
+    changed = key;
+    changed.file.sidecarSize = 100;
+    CHECK(!disk.contains(changed));
+    changed = key;
+    changed.quality++;
+    CHECK(!disk.contains(changed));
+}
+
+void testDiskNameCollision(const std::string &directory)
+{
+    BlackmagicRAWDiskCache &disk = BlackmagicRAWDiskCache::instance();
+    clearDirectory(directory);
+    reindex(directory);
+    BlackmagicRAWFrameCache::Key first = getKey(1);
+    BlackmagicRAWFrameCache::Key second = getKey(2);
+    CHECK(disk.store(first, getFrame(8, 8, 1.f)));
+    std::vector<std::string> names = listFrames(directory);
+    CHECK(disk.store(second, getFrame(8, 8, 2.f)));
+    std::vector<std::string> both = listFrames(directory);
+    CHECK(names.size() == 1 && both.size() == 2);
+    if (names.size() != 1 || both.size() != 2) { return; }
+    std::string secondName = both[0] == names[0] ? both[1] : both[0];
+
+    // the file of the first key under the name of the second, as a hash
+    // collision would leave it
+    CHECK(rename((directory + "/" + names[0]).c_str(), (directory + "/" + secondName).c_str()) == 0);
+    reindex(directory);
+    CHECK(disk.contains(second));
+    CHECK(!disk.read(second));
+    // dropped from the index once the header didn't match
+    CHECK(!disk.contains(second));
+    CHECK(!disk.contains(first));
+}
+
+void testDiskCollect(const std::string &directory)
+{
+    BlackmagicRAWDiskCache &disk = BlackmagicRAWDiskCache::instance();
+    clearDirectory(directory);
+    reindex(directory);
+    const int width = 16;
+    const int height = 16;
+    const size_t fileBytes = 4096 + (size_t)width * height * 3 * sizeof(float);
+    size_t budget = disk.budget();
+    disk.setBudget(4 * fileBytes);
+
+    for (uint64_t frame = 0; frame < 3; ++frame) {
+        CHECK(disk.store(getKey(frame), getFrame(width, height, (float)frame)));
+    }
+    // the read keeps frame 0 over frames 1 and 2
+    CHECK(disk.read(getKey(0)));
+    CHECK(disk.store(getKey(3), getFrame(width, height, 3.f)));
+    CHECK(disk.sizeBytes() == 4 * fileBytes);
+    CHECK(disk.store(getKey(4), getFrame(width, height, 4.f)));
+    CHECK(disk.contains(getKey(0)));
+    CHECK(!disk.contains(getKey(1)));
+    CHECK(!disk.contains(getKey(2)));
+    CHECK(disk.contains(getKey(3)));
+    CHECK(disk.contains(getKey(4)));
+
+    for (uint64_t frame = 5; frame < 20; ++frame) {
+        CHECK(disk.store(getKey(frame), getFrame(width, height, (float)frame)));
+        CHECK(disk.sizeBytes() <= disk.budget());
+        CHECK(directorySize(directory) <= disk.budget());
+    }
+    CHECK(disk.contains(getKey(19)));
+
+    // a lower budget collects right away
+    disk.setBudget(2 * fileBytes);
+    CHECK(disk.sizeBytes() <= disk.budget());
+    CHECK(directorySize(directory) <= disk.budget());
+    CHECK(disk.contains(getKey(19)));
+
+    // frames over the budget aren't stored at all
+    disk.setBudget(fileBytes - 1);
+    CHECK(!disk.store(getKey(20), getFrame(width, height, 20.f)));
+    CHECK(!disk.contains(getKey(20)));
+
+    disk.setBudget(budget);
+}
+
+void testTierBudgets()
+{
+    BlackmagicRAWFrameCache &cache = BlackmagicRAWFrameCache::instance();
+    const int width = 64;
+    const int height = 64;
+    const size_t frameBytes = (size_t)width * height * 3 * sizeof(float);
+    size_t budget = cache.budget();
+    size_t compressedBudget = cache.compressedBudget();
+    cache.clear();
+    cache.setBudget(2 * frameBytes);
+    // frames waiting to be compressed count at their full size
+    cache.setCompressedBudget(frameBytes);
+    for (uint64_t frame = 0; frame < 40; ++frame) {
+        cache.insert(getKey(frame), getFrame(width, height, (float)frame));
+        CHECK(cache.sizeBytes() <= cache.budget());
+        CHECK(cache.compressedSizeBytes() <= cache.compressedBudget());
+        // the frames held in memory, all of them come from the pool
+        CHECK(BlackmagicRAWBufferPool::instance().stats().usedBytes <= cache.budget() + cache.compressedBudget());
+    }
+    CHECK(cache.contains(getKey(39)));
+    cache.clear();
+    cache.setBudget(budget);
+    cache.setCompressedBudget(compressedBudget);
+}
+}
+
+int main()
+{
+    testCompressedZeros();
+    testCompressedGradient();
+    testCompressedRandom();
+    testCompressedSpecialValues();
+    testCompressedSinglePixel();
+
+    char directory[] = "/tmp/braw-cache-test-XXXXXX";
+    if (mkdtemp(directory) == nullptr) {
+        std::cout << "no temporary directory" << std::endl;
+        return 1;
+    }
+    testDiskRoundTrip(directory);
+    testDiskNameCollision(directory);
+    testDiskCollect(directory);
+    BlackmagicRAWDiskCache::instance().setDirectory(std::string());
+    clearDirectory(directory);
+    rmdir(directory);
+    testTierBudgets();
+
+    std::cout << (failures == 0 ? "ok" : "FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+/*
+###################################################################################
+#
+# BlackmagicRAWOFX
+#
+# Copyright (C) 2020 Ole-André Rodlie <ole.andre.rodlie@gmail.com>
+#
+# BlackmagicRAWOFX is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as published
+# by the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# BlackmagicRAWOFX is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with openfx-arena.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+#
+###################################################################################
+*/
+
+// BlackmagicRAWTransfer kernels, SIMD against scalar output
+
+// the kernels live in an anonymous namespace, so the tests are built with
+// the translation unit itself instead of linking it
+#include "BlackmagicRAWTransfer.cpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+int failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::cout << __FILE__ << ":" << __LINE__ << ": " #condition << std::endl; failures++; } } while (0)
+
+// marks values past the end of a destination, a kernel must leave them alone
+const float kGuard = -12345.f;
+
+bool near(float a,
+          float b)
+{
+    return std::fabs(a - b) <= 1e-6f * std::max(1.f, std::max(std::fabs(a), std::fabs(b)));
+}
+
+std::vector<float> randomFloats(size_t count,
+                                std::mt19937 &random)
+{
+    std::uniform_real_distribution<float> distribution(-4.f, 16.f);
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = distribution(random);
+    }
+    return values;
+}
+
+// 2x2 box average, a single row or column is averaged in the other direction only
+std::vector<float> halveReference(const std::vector<float> &src,
+                                  int srcWidth,
+                                  int srcHeight)
+{
+    int width = std::max(1, srcWidth / 2);
+    int height = std::max(1, srcHeight / 2);
+    std::vector<float> dst((size_t)width * height * 3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                float sum = 0.f;
+                int samples = 0;
+                for (int dy = 0; dy < std::min(2, srcHeight); ++dy) {
+                    for (int dx = 0; dx < std::min(2, srcWidth); ++dx) {
+                        sum += src[((size_t)(y * 2 + dy) * srcWidth + x * 2 + dx) * 3 + c];
+                        samples++;
+                    }
+                }
+                dst[((size_t)y * width + x) * 3 + c] = sum / samples;
+            }
+        }
+    }
+    return dst;
+}
+
+void testHalveRow()
+{
+#ifdef BRAW_TRANSFER_X86
+    if (BlackmagicRAWTransfer::getInstructionSet() < BlackmagicRAWTransfer::instructionSetSSE41) {
+        std::cout << "no SSE4.1, halveRowSSE41 skipped" << std::endl;
+        return;
+    }
+    std::mt19937 random(1);
+    // odd counts for the scalar tail, offsets for unaligned rows
+    for (int count = 1; count <= 37; ++count) {
+        for (int offset = 0; offset < 4; ++offset) {
+            std::vector<float> rows = randomFloats(offset + (size_t)count * 12, random);
+            const float *row0 = &rows[offset];
+            const float *row1 = row0 + (size_t)count * 6;
+            std::vector<float> scalar((size_t)count * 3 + 4, kGuard);
+            std::vector<float> simd((size_t)count * 3 + offset + 4, kGuard);
+            halveRowScalar(row0, row1, &scalar[0], count);
+            halveRowSSE41(row0, row1, &simd[offset], count);
+            bool same = true;
+            for (int i = 0; i < count * 3; ++i) {
+                same = same && near(scalar[i], simd[offset + i]);
+            }
+            CHECK(same);
+            CHECK(simd[offset + count * 3] == kGuard);
+        }
+    }
+#endif
+}
+
+void testHalveRGB()
+{
+    const int sizes[][2] = {
+        {1, 1}, {1, 2}, {2, 1}, {1, 7}, {7, 1}, {2, 2}, {3, 3},
+        {5, 4}, {4, 5}, {33, 17}, {64, 1}, {1, 64}, {130, 66}
+    };
+    std::mt19937 random(2);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        int width = sizes[i][0];
+        int height = sizes[i][1];
+        std::vector<float> src = randomFloats((size_t)width * height * 3, random);
+        std::vector<float> expected = halveReference(src, width, height);
+        std::vector<float> dst(expected.size() + 4, kGuard);
+        BlackmagicRAWTransfer::halveRGB(&src[0], width, height, &dst[0]);
+        bool same = true;
+        for (size_t j = 0; j < expected.size(); ++j) {
+            same = same && near(expected[j], dst[j]);
+        }
+        if (!same) { std::cout << width << "x" << height << std::endl; }
+        CHECK(same);
+        CHECK(dst[expected.size()] == kGuard);
+    }
+}
+
+#ifdef BRAW_TRANSFER_X86
+// equal halves, or both NaN since the scalar pack drops the payload
+bool sameHalf(uint16_t a,
+              uint16_t b)
+{
+    bool nanA = (a & 0x7c00) == 0x7c00 && (a & 0x03ff) != 0;
+    bool nanB = (b & 0x7c00) == 0x7c00 && (b & 0x03ff) != 0;
+    return a == b || (nanA && nanB);
+}
+
+bool sameFloat(float a,
+               float b)
+{
+    uint32_t bitsA, bitsB;
+    std::memcpy(&bitsA, &a, sizeof(bitsA));
+    std::memcpy(&bitsB, &b, sizeof(bitsB));
+    return bitsA == bitsB || (a != a && b != b);
+}
+#endif
+
+void testPackHalf()
+{
+#ifdef BRAW_TRANSFER_X86
+    if (!useF16C()) {
+        std::cout << "no F16C, packHalfF16C skipped" << std::endl;
+        return;
+    }
+    // a sweep of bit patterns, denormals, overflow, infinities and NaN included
+    std::vector<float> values;
+    for (uint64_t bits = 0; bits <= 0xffffffffull; bits += 4099) {
+        uint32_t pattern = (uint32_t)bits;
+        float value;
+        std::memcpy(&value, &pattern, sizeof(value));
+        values.push_back(value);
+    }
+    const float special[] = {0.f, -0.f, 65504.f, 65520.f, 6.1e-5f, 5.96e-8f, 2.98e-8f,
+                             std::numeric_limits<float>::infinity(),
+                             -std::numeric_limits<float>::infinity(),
+                             std::numeric_limits<float>::quiet_NaN()};
+    values.insert(values.end(), special, special + sizeof(special) / sizeof(special[0]));
+    std::vector<uint16_t> scalar(values.size());
+    std::vector<uint16_t> simd(values.size());
+    packHalfScalar(&values[0], &scalar[0], values.size());
+    packHalfF16C(&values[0], &simd[0], values.size());
+    bool same = true;
+    for (size_t i = 0; i < values.size(); ++i) {
+        same = same && sameHalf(scalar[i], simd[i]);
+    }
+    CHECK(same);
+
+    // odd counts for the scalar tail, offsets for unaligned rows
+    std::mt19937 random(3);
+    for (size_t count = 1; count <= 37; ++count) {
+        for (size_t offset = 0; offset < 4; ++offset) {
+            std::vector<float> src = randomFloats(offset + count, random);
+            std::vector<uint16_t> expected(count);
+            std::vector<uint16_t> dst(offset + count + 8, 0xabcd);
+            packHalfScalar(&src[offset], &expected[0], count);
+            packHalfF16C(&src[offset], &dst[offset], count);
+            CHECK(std::equal(expected.begin(), expected.end(), dst.begin() + offset));
+            CHECK(dst[offset + count] == 0xabcd);
+        }
+    }
+#endif
+}
+
+void testUnpackHalf()
+{
+#ifdef BRAW_TRANSFER_X86
+    if (!useF16C()) {
+        std::cout << "no F16C, unpackHalfF16C skipped" << std::endl;
+        return;
+    }
+    // every half
+    std::vector<uint16_t> halves(65536);
+    for (size_t i = 0; i < halves.size(); ++i) {
+        halves[i] = (uint16_t)i;
+    }
+    std::vector<float> scalar(halves.size());
+    std::vector<float> simd(halves.size());
+    unpackHalfScalar(&halves[0], &scalar[0], halves.size());
+    unpackHalfF16C(&halves[0], &simd[0], halves.size());
+    bool same = true;
+    for (size_t i = 0; i < halves.size(); ++i) {
+        same = same && sameFloat(scalar[i], simd[i]);
+    }
+    CHECK(same);
+
+    for (size_t count = 1; count <= 37; ++count) {
+        for (size_t offset = 0; offset < 4; ++offset) {
+            std::vector<float> expected(count);
+            std::vector<float> dst(offset + count + 8, kGuard);
+            unpackHalfScalar(&halves[1000 + offset], &expected[0], count);
+            unpackHalfF16C(&halves[1000 + offset], &dst[offset], count);
+            CHECK(std::equal(expected.begin(), expected.end(), dst.begin() + offset));
+            CHECK(dst[offset + count] == kGuard);
+        }
+    }
+#endif
+}
+
+// whichever kernel is dispatched, halves survive a round trip
+void testHalfRoundTrip()
+{
+    std::vector<uint16_t> halves;
+    for (uint32_t i = 0; i < 65536; ++i) {
+        if ((i & 0x7c00) != 0x7c00) {
+            halves.push_back((uint16_t)i);
+        }
+    }
+    std::vector<float> values(halves.size());
+    std::vector<uint16_t> packed(halves.size());
+    BlackmagicRAWTransfer::unpackHalf(&halves[0], &values[0], halves.size());
+    BlackmagicRAWTransfer::packHalf(&values[0], &packed[0], values.size());
+    CHECK(packed == halves);
+}
+}
+
+int main()
+{
+    testHalveRow();
+    testHalveRGB();
+    testPackHalf();
+    testUnpackHalf();
+    testHalfRoundTrip();
+    std::cout << (failures == 0 ? "ok" : "FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}